@@ -1,4 +1,14 @@
 #include <Phpoc.h>
+#include <EEPROM.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <avr/wdt.h>
+#include "StationInterlock.h"
+#include "StationIdleSleep.h"
+
+// Define STATION_FAULT_INJECTION to build a test image that accepts
+// "$INJ,<fault>,<delay ms>" and injects faults on the bench
+// #define STATION_FAULT_INJECTION
 
 // Server instances for ROS and web communication
 PhpocServer ros_server(23);  // ROS server on port 23
@@ -7,6 +17,16 @@ PhpocServer web_server(80);  // Web server on port 80
 // Flag to track if a client was previously connected
 bool alreadyConnected = false;
 
+// Capability descriptor sent to a client after its first "$..." line, and on "$CAP".
+// A legacy client never sends one, so it never sees the descriptor:
+// "$CAP,<variant>,<firmware>,<bays>,<wpt>,<legacy protocol>,<event protocol>\n"
+constexpr char STATION_VARIANT[] = "ros";      // This sketch: ROS port 23 plus web port 80
+constexpr char FIRMWARE_VERSION[] = "1.0.0";   // Bumped with every released change
+constexpr uint8_t STATION_BAYS = 1;            // Landing bays (door and plate pairs)
+constexpr uint8_t STATION_HAS_WPT = 1;         // Wireless power relay fitted
+constexpr uint8_t LEGACY_PROTOCOL_VERSION = 1; // Single-letter commands and acknowledgements
+constexpr uint8_t EVENT_PROTOCOL_VERSION = 1;  // "$..." control lines and event lines
+
 // Pin assignments using modern C++ constexpr for type safety and clarity
 constexpr int DOOR_DIRECTION_PIN = 4;    // Pin controlling the door motor direction
 constexpr int DOOR_ENABLE_PIN = 5;       // Pin to enable/disable the door motor
@@ -16,18 +36,366 @@ constexpr int DOOR_PHOTO_PIN = 8;        // Pin for door photo sensor
 constexpr int PLATE_PHOTO_PIN = 9;       // Pin for landing plate photo sensor
 constexpr int WPT_RELAY_PIN = 10;        // Pin for wireless power transfer relay
 
-// Timing constants for door and plate operations
+// Default timing for door and plate operations (runtime values live in params[])
 constexpr unsigned long DOOR_TIME = 25000;  // Time in milliseconds for door operation
 constexpr unsigned long PLATE_TIME = 45000; // Time in milliseconds for plate operation
 
+// Runtime parameters, read and written over the link with $PGET/$PSET,
+// applied with $PAPPLY and persisted with $PSAVE
+enum ParamId : uint8_t {
+    PARAM_DOOR_TIME = 0,        // Door operation time in milliseconds
+    PARAM_PLATE_TIME,           // Plate operation time in milliseconds
+    PARAM_MOTOR_ENABLE_LEVEL,   // Level on an enable pin that runs its motor
+    PARAM_WPT_ACTIVE_LEVEL,     // Level on the relay pin that turns wireless power on
+    PARAM_SENSOR_HOME_LEVEL,    // Level a photo sensor reads when its axis is home
+    PARAM_COUNT
+};
+
+// Type, range and default of one parameter. A duration must lie in its range;
+// a level must be LOW or HIGH. The type is reported with "$PRM".
+enum ParamType : uint8_t { PARAM_MILLIS, PARAM_LEVEL };
+
+const char* const PARAM_TYPE_NAMES[] = { "ms", "level" };
+
+struct ParamInfo {
+    uint8_t type;               // One of ParamType
+    unsigned long minimum;      // Smallest accepted value
+    unsigned long maximum;      // Largest accepted value
+    unsigned long defaultValue; // Value used when nothing valid is stored
+};
+
+const ParamInfo PARAM_INFO[PARAM_COUNT] PROGMEM = {
+    { PARAM_MILLIS, 1000, 120000, DOOR_TIME },
+    { PARAM_MILLIS, 1000, 120000, PLATE_TIME },
+    { PARAM_LEVEL,  LOW,  HIGH,   LOW },    // Enable pins are active-low
+    { PARAM_LEVEL,  LOW,  HIGH,   HIGH },   // HIGH activates the relay
+    { PARAM_LEVEL,  LOW,  HIGH,   LOW }     // Sensors read LOW when closed/retracted
+};
+
+// Active values are read directly on the hot path; $PSET only touches the
+// staged copy, which is copied over in one step at the top of loop()
+unsigned long params[PARAM_COUNT];
+unsigned long stagedParams[PARAM_COUNT];
+bool paramsApplyPending = false;
+
+// EEPROM image of the parameters, validated with a CRC on load
+constexpr int PARAMS_EEPROM_ADDRESS = 0;
+constexpr uint16_t PARAMS_MAGIC = 0x5350;   // "SP", bumped if the layout changes
+
+struct StoredParams {
+    uint16_t magic;
+    unsigned long values[PARAM_COUNT];
+    uint16_t crc;
+};
+
+// Position estimates are kept in per-mille of full travel
+constexpr int POSITION_HOME = 0;         // Door closed / plate retracted (the sensed end)
+constexpr int POSITION_OUT = 1000;       // Door open / plate extended (the timed end)
+
+// Motion state of a door or plate axis as far as the station can tell.
+// Only the home end (closed/retracted) has a photo sensor; the out end is
+// reached by running the motor for the configured operation time.
+enum AxisMotion : uint8_t {
+    AXIS_STOPPED = 0,   // Not moving (or moving with no estimate to update)
+    AXIS_HOMING,        // Closing the door / retracting the plate
+    AXIS_OUTBOUND       // Opening the door / extending the plate
+};
+
+// Estimated state of one motorised axis
+struct AxisState {
+    uint8_t motion;              // One of AxisMotion
+    unsigned long moveStartedAt; // millis() when the current move started
+    int startPosition;           // Position estimate when the current move started
+    int position;                // Current position estimate (POSITION_HOME..POSITION_OUT)
+    unsigned long outboundTime;  // Time in milliseconds for a full outbound move
+    unsigned long homingTime;    // Learned time in milliseconds for a full homing move
+    bool slowReported;           // The current move has already been reported as slow
+};
+
+AxisState doorAxis = { AXIS_STOPPED, 0, POSITION_HOME, POSITION_HOME, DOOR_TIME, DOOR_TIME, false };
+AxisState plateAxis = { AXIS_STOPPED, 0, POSITION_HOME, POSITION_HOME, PLATE_TIME, PLATE_TIME, false };
+
+// Problems UpdateAxis() can see in a move
+enum AxisCheck : uint8_t {
+    AXIS_OK = 0,
+    AXIS_SENSOR_STUCK,  // Home sensor still reports home well into an outbound move
+    AXIS_SLOW           // Homing move is taking half again as long as learned
+};
+
+// Time in milliseconds an outbound move may take to clear the home sensor
+constexpr unsigned long SENSOR_CLEAR_TIME = 3000;
+
+// Phases of the non-blocking takeoff and landing sequences
+enum SequencePhase : uint8_t {
+    SEQ_IDLE = 0,       // No sequence running
+    SEQ_TAKEOFF_DOOR,   // Takeoff: waiting for the door to open
+    SEQ_TAKEOFF_PLATE,  // Takeoff: waiting for the plate to extend
+    SEQ_LANDING_PLATE,  // Landing: waiting for the plate to retract
+    SEQ_LANDING_DOOR    // Landing: waiting for the door to close
+};
+
+SequencePhase sequencePhase = SEQ_IDLE;    // Current sequence phase
+unsigned long sequencePhaseStartedAt = 0;  // millis() when the current phase started
+bool sequenceFinished = false;             // The last sequence ran to its end
+
+// Motion commands are acknowledged twice: "accepted" as soon as they start
+// (the legacy letter for ROS clients, then "$ACK,<cmd>,<id>\n") and "completed"
+// with a $DONE event once the end state is sensed. The "$..." events only go to
+// a client that has sent a "$..." line itself: a legacy client reads every byte
+// as an acknowledgement letter and would take the 'A' in "$ACK" for one. At most one
+// operation runs per axis, plus one sequence that owns both axes. The id lets a
+// client cancel its own operation with "$CAN,<id>" instead of Stop All.
+enum OperationSlot : uint8_t {
+    OP_DOOR = 0,        // Door command 'c'/'d' (web 'B'/'E')
+    OP_PLATE,           // Plate command 'a'/'b' (web 'A'/'D')
+    OP_SEQUENCE,        // Takeoff or landing sequence
+    OP_SLOT_COUNT
+};
+
+// How an operation ended
+enum CompletionResult : uint8_t {
+    DONE_OK = 0,        // Reached its end state
+    DONE_STOPPED,       // Stopped before reaching it (Stop All, parameter change)
+    DONE_SUPERSEDED,    // Replaced by a newer command on the same axis
+    DONE_FAULT,         // Ended by a fault, reported with the completion
+    DONE_CANCELLED      // Cancelled by id; its axes were stopped where they were
+};
+
+// A motion command waiting for its completion event
+struct Operation {
+    bool active;                // Slot is in use
+    uint16_t id;                // Operation id, never 0
+    char command;               // Command character as received
+    PhpocClient client;         // Client that receives the completion
+    int target;                 // Target position of an axis command
+    unsigned long startedAt;    // millis() when the command was accepted
+    unsigned long phaseTime[2]; // Measured durations: the move, or both sequence phases
+    uint8_t fault;              // First fault on this operation's axes, FAULT_NONE if none
+};
+
+Operation operations[OP_SLOT_COUNT];
+uint16_t nextOperationId = 1;  // Id given to the next accepted operation
+
+// Recent-command window. A client that may retry over a new connection sends
+// "$CMD,<key>,<c>" instead of the bare command letter; a key already in the
+// window is not run again and its recorded outcome is replayed as
+// "$DUP,<key>,<cmd>,<reason>,<id>,<result>\n". The window lives in RAM, so it
+// covers link drops but not a station reset.
+constexpr uint8_t JOURNAL_SIZE = 8;          // Keyed commands remembered
+constexpr uint8_t JOURNAL_RUNNING = 0xFF;    // Result of an operation still in progress
+constexpr uint8_t NO_JOURNAL_ENTRY = 0xFF;   // No keyed command is being run
+
+// Outcome of one keyed command
+struct JournalEntry {
+    unsigned long key;     // Idempotency key chosen by the client, never 0
+    char command;          // Command character it carried
+    uint8_t reason;        // Interlock reason, REASON_OK when accepted
+    uint16_t operationId;  // Operation it started, 0 for immediate commands
+    uint8_t result;        // CompletionResult, or JOURNAL_RUNNING
+};
+
+JournalEntry journal[JOURNAL_SIZE];
+uint8_t journalNext = 0;                       // Oldest entry, overwritten next
+uint8_t currentJournalEntry = NO_JOURNAL_ENTRY; // Entry of the command being run
+
+// Fault codes reported on the "faults" topic
+enum FaultCode : uint8_t {
+    FAULT_NONE = 0,             // No fault since boot
+    FAULT_PLATE_HOME_TIMEOUT,   // Plate sensor did not report retracted within the plate time
+    FAULT_DOOR_HOME_TIMEOUT,    // Door sensor did not report closed within the door time
+    FAULT_SEQUENCE_INTERLOCK,   // A sequence step was refused by the interlock table
+    FAULT_DOOR_SENSOR_STUCK,    // Door sensor did not clear when the door started opening
+    FAULT_PLATE_SENSOR_STUCK,   // Plate sensor did not clear when the plate started extending
+    FAULT_DOOR_SLOW,            // Door homing is taking much longer than learned
+    FAULT_PLATE_SLOW,           // Plate homing is taking much longer than learned
+    FAULT_SESSION_LOST,         // The client that started a sequence disconnected during it
+    FAULT_RESET                 // The station restarted (injected reset)
+};
+
+uint8_t lastFault = FAULT_NONE;  // Most recent fault code
+uint16_t faultCount = 0;         // Number of faults raised since boot
+
+// Recovery timeline of the most recent fault, in milliseconds from its start
+// (the injection time for an injected fault, otherwise the detection time):
+// detected when raised, safe once no motor is enabled and no sequence runs, and
+// resumed when a client sends its next command afterwards
+struct Recovery {
+    unsigned long startedAt;    // millis() the timeline is measured from
+    unsigned long detectTime;   // Time to detect
+    unsigned long safeTime;     // Time to safe state
+    unsigned long resumeTime;   // Time to resume
+    bool safe;                  // Safe state reached
+    bool resumed;               // Operation resumed
+};
+
+Recovery recovery = { 0, 0, 0, 0, true, true };
+
+#if defined(STATION_FAULT_INJECTION)
+// Faults the test image can inject
+enum InjectedFault : uint8_t {
+    INJECT_NONE = 0,
+    INJECT_DOOR_SENSOR_STUCK,   // Door sensor keeps its current reading
+    INJECT_PLATE_SENSOR_STUCK,  // Plate sensor keeps its current reading
+    INJECT_SLOW_PLATE,          // Plate sensor reports home only after twice the learned time
+    INJECT_SESSION_DROP,        // Every subscribed client is disconnected
+    INJECT_RESET,               // Watchdog reset, as if power dipped mid-move
+    INJECT_COUNT,
+    INJECT_RANDOM = 255         // Pick a fault and a delay at random
+};
+
+uint8_t scheduledFault = INJECT_NONE;    // Fault waiting for its delay to pass
+unsigned long scheduledAt = 0;           // millis() when it was scheduled
+unsigned long scheduledDelay = 0;        // Delay in milliseconds before injecting
+uint8_t activeFault = INJECT_NONE;       // Fault currently injected
+unsigned long injectedAt = 0;            // millis() when it was injected
+bool stuckReading = false;               // Sensor reading held by a stuck-sensor fault
+
+// Survives the watchdog reset so the restarted image knows it was injected
+uint16_t resetMarker __attribute__((section(".noinit")));
+constexpr uint16_t RESET_MARKER = 0xFA17;
+#endif
+
+// Clear the reset flags and stop the watchdog before the C runtime starts.
+// After a watchdog reset the watchdog stays enabled with its shortest timeout,
+// and a bootloader that does not clear it would keep the board boot-looping.
+void DisableWatchdogAtBoot() __attribute__((naked, used, section(".init3")));
+void DisableWatchdogAtBoot() {
+    MCUSR = 0;
+    wdt_disable();
+}
+
+// Loop statistics reported on the "metrics" topic, collected per one-second window
+unsigned long metricsWindowStartedAt = 0;  // millis() when the current window started
+unsigned int windowLoopCount = 0;          // Loop passes in the current window
+unsigned long windowMaxLoopMicros = 0;     // Longest loop pass in the current window
+unsigned int loopsPerSecond = 0;           // Loop passes in the last full window
+unsigned long maxLoopMicros = 0;           // Longest loop pass in the last full window
+unsigned long windowIdleMillis = 0;        // Time spent asleep in the current window
+unsigned long windowMaxWakeMicros = 0;     // Slowest sensor-edge wake-up in the current window
+unsigned long windowMaxPollGap = 0;        // Longest gap between shield polls in the current window
+unsigned int idlePermille = 0;             // Share of the last full window spent asleep
+unsigned long maxWakeMicros = 0;           // Slowest sensor-edge wake-up in the last full window
+unsigned long maxPollGap = 0;              // Longest gap between shield polls in the last full window
+unsigned long lastPollAt = 0;              // millis() when the shield was last polled
+unsigned long windowMaxAcceptMicros = 0;   // Slowest shield accept poll in the current window
+unsigned int windowBusyCount = 0;          // Clients turned away in the current window
+unsigned long maxAcceptMicros = 0;         // Slowest shield accept poll in the last full window
+unsigned int busyCount = 0;                // Clients turned away in the last full window
+
+// A client that sends a control line while every subscriber slot is taken gets
+// "$BUSY,<retry after ms>\n" and is disconnected. The retry delay is jittered
+// and grows with the number of clients turned away in the last window, so a
+// reconnect storm spreads itself out instead of returning all at once.
+constexpr unsigned long BUSY_RETRY_MIN = 500;    // Shortest retry delay in milliseconds
+constexpr unsigned int BUSY_RETRY_MAX_SCALE = 16; // Cap on the jitter range, in BUSY_RETRY_MIN
+
+// Topics a ROS or web client can subscribe to with "$SUB,<topic>,<mode>,<ms>\n"
+enum Topic : uint8_t {
+    TOPIC_DOOR = 0,     // Door position estimate, motion and sensor
+    TOPIC_PLATE,        // Plate position estimate, motion and sensor
+    TOPIC_WPT,          // Wireless power state
+    TOPIC_FAULTS,       // Last fault and fault count
+    TOPIC_METRICS,      // Loop rate, worst loop time and idle statistics
+    TOPIC_READY,        // Time-to-ready estimates
+    TOPIC_COUNT
+};
+
+const char* const TOPIC_NAMES[TOPIC_COUNT] = { "door", "plate", "wpt", "faults", "metrics", "ready" };
+
+// Delivery mode of one subscription
+enum TopicMode : uint8_t {
+    TOPIC_OFF = 0,      // Not subscribed
+    TOPIC_ON_CHANGE,    // Sent when the topic changes, at most once per interval
+    TOPIC_PERIODIC      // Sent once per interval
+};
+
+constexpr uint8_t MAX_SUBSCRIBERS = 4;           // Client slots (PHPoC serves a few sockets)
+constexpr uint8_t CONTROL_LINE_SIZE = 32;        // Longest "$..." control line accepted
+constexpr unsigned int MIN_TOPIC_INTERVAL = 50;  // Fastest rate a topic can be sent at
+
+// Per-client subscription state for one topic
+struct Subscription {
+    uint8_t mode;              // One of TopicMode
+    unsigned int interval;     // Rate limit (on-change) or period (periodic) in milliseconds
+    unsigned long lastSentAt;  // millis() when the topic was last sent to this client
+    uint16_t lastKey;          // Change key of the topic when it was last sent
+};
+
+// A connected ROS or web client with its subscriptions and partial control line
+struct Subscriber {
+    bool active;                             // Slot is in use
+    PhpocClient client;                      // Client socket
+    Subscription topics[TOPIC_COUNT];        // Subscriptions indexed by Topic
+    char line[CONTROL_LINE_SIZE];            // Control line being received
+    uint8_t lineLength;                      // Bytes in line, 0 when not inside a line
+    char keyedCommand;                       // Command of a new "$CMD" line, 0 if none
+    bool eventProtocol;                      // Has sent a "$..." line, so it reads event lines
+    unsigned long keyedCommandKey;           // Its idempotency key
+};
+
+Subscriber subscribers[MAX_SUBSCRIBERS];
+
+// Bytes read from one client in one loop pass. Reading everything both clients
+// have sent before running any of it lets a Stop All stop the station ahead of
+// the rest of the pass's input, and win over every motion command in it: those
+// are refused with REASON_STOP_ALL, whichever client sent them and whether they
+// came before or after the stop.
+constexpr uint8_t INPUT_BURST_SIZE = 32;  // Most bytes taken from a client per pass
+bool stopAllThisPass = false;             // A Stop All is among this pass's input
+
+struct InputBurst {
+    char bytes[INPUT_BURST_SIZE];  // Bytes to run in arrival order
+    uint8_t length;                // Number of bytes
+    bool stopRequested;            // A Stop All was received outside a control line
+};
+
 // Function prototypes for motor and relay control operations
+// Actuator functions return REASON_OK when started, or the interlock reason otherwise
 void StopAllMotors();       // Stops all motors by disabling them
-void CloseDoor();           // Starts closing the door
-void OpenDoor();            // Starts opening the door
-void RetractPlate();        // Starts retracting the landing plate (moves in)
-void ExtendPlate();         // Starts extending the landing plate (moves out)
-void TakeOffSequence();     // Executes the takeoff sequence: open door, then extend plate
-void LandingSequence();     // Executes the landing sequence: retract plate, then close door
+void StopAxisMotor(AxisState& axis, int enablePin); // Stops one motor
+uint8_t CloseDoor();        // Starts closing the door
+uint8_t OpenDoor();         // Starts opening the door
+uint8_t RetractPlate();     // Starts retracting the landing plate (moves in)
+uint8_t ExtendPlate();      // Starts extending the landing plate (moves out)
+uint8_t CheckInterlock(uint8_t command); // Looks up a command against the current state
+bool ReportInterlock(PhpocClient& client, char command, uint8_t reason); // Sends a denial
+void TakeOffSequence();     // Starts the takeoff sequence: open door, then extend plate
+void LandingSequence();     // Starts the landing sequence: retract plate, then close door
+void AbortSequence();       // Abandons a running sequence without touching the motors
+uint8_t UpdateAxis(AxisState& axis, bool isHome, int enablePin); // Advances an axis position estimate
+void CheckAxis(uint8_t check, uint8_t stuckFault, uint8_t slowFault); // Acts on a failed axis check
+void UpdateRecovery();      // Tracks the safe state of the last fault
+void StartOperation(uint8_t slot, char command, PhpocClient& client, int target); // Tracks a command
+void UpdateOperations();    // Sends completions for operations that have ended
+void AcknowledgeCommand(PhpocClient& client, char command, uint16_t id); // Sends "$ACK"
+void SendEvent(PhpocClient& client, const char* line, int length); // Sends an event to an event client
+void ReportProgress();      // Sends the running sequence's phase and remaining time
+bool CancelOperation(uint16_t id, PhpocClient& requester); // Stops only the axes of one operation
+char TakeKeyedCommand(Subscriber* subscriber); // Starts journaling a new "$CMD" command
+void NoteCommandAccepted(); // Tracks the resumption of the last fault
+void UpdateFaultInjection();// Injects a scheduled fault (test images only)
+void UpdateSequence();      // Advances the running sequence to its next phase
+void RaiseFault(uint8_t fault); // Records a fault for the faults topic
+void AttributeFault(uint8_t fault); // Marks the operations a fault belongs to
+void LoadParams();          // Loads parameters from EEPROM, falling back to defaults
+void SaveParams();          // Stores the active parameters to EEPROM
+void ApplyParams();         // Makes the staged parameters active
+bool IsParamValid(uint8_t id, unsigned long value); // Checks a value against its type and range
+void SeedAxisPositions();   // Sets the position estimates from the home sensors
+bool IsDoorHome();          // Reads the door sensor (true when closed)
+bool IsPlateHome();         // Reads the plate sensor (true when retracted)
+Subscriber* FindSubscriber(PhpocClient& client); // Finds or allocates a client slot
+bool ReadControlLine(Subscriber* subscriber, char c); // Collects "$..." control lines
+void SendCapabilities(PhpocClient& client); // Sends the capability descriptor
+bool RejectControlLine(PhpocClient& client, Subscriber* subscriber, char c); // Sends "$BUSY"
+void ReadInputBurst(PhpocClient& client, char stopCommand, InputBurst& burst); // Reads a pass's input
+bool HandleRosCommand(PhpocClient& ros_client, char command); // Runs one ROS byte
+bool RefuseForStopAll(PhpocClient& client, char command, const char* motionCommands); // Yields to a stop
+void RunStopAll(bool fromRos); // Stops everything for a Stop All
+bool HandleWebCommand(PhpocClient& web_client, char command); // Runs one web byte
+void PublishTopics();       // Sends due topics to the clients subscribed to them
+bool IsIdle();              // True when nothing needs the loop to spin
+bool IsAnyMotorEnabled();   // True while either motor enable pin is active
 void EnableWirelessPower(); // Turns on wireless power
 void DisableWirelessPower();// Turns off wireless power
 
@@ -40,8 +408,14 @@ void setup() {
     // Wait for the serial port to connect (needed for some Arduino boards)
     while (!Serial);
 
+    // Load runtime parameters before any pin is driven
+    LoadParams();
+
     // Initialize PHPoC [WiFi] Shield with logging enabled for SPI and network
     Phpoc.begin(PF_LOG_SPI | PF_LOG_NET);
+    // The shield's start-up time varies, which decorrelates the BUSY retry
+    // jitter of stations that were powered up together
+    randomSeed(micros());
 
     // Start WebSocket server for web clients
     web_server.beginWebSocket("remote_push");
@@ -63,15 +437,51 @@ void setup() {
     pinMode(PLATE_PHOTO_PIN, INPUT);
     pinMode(WPT_RELAY_PIN, OUTPUT);
 
+    // Let photo sensor edges wake the MCU from idle sleep
+    EnableSensorWake(DOOR_PHOTO_PIN);
+    EnableSensorWake(PLATE_PHOTO_PIN);
+
     // Initially stop all motors and ensure wireless power is off
     StopAllMotors();
     DisableWirelessPower();
+
+    // Seed position estimates from the home sensors
+    SeedAxisPositions();
+
+#if defined(STATION_FAULT_INJECTION)
+    // An injected reset is measured from boot: the motors are already stopped
+    if (resetMarker == RESET_MARKER) {
+        resetMarker = 0;
+        RaiseFault(FAULT_RESET);
+        recovery.startedAt = 0;
+        recovery.detectTime = millis();
+    }
+#endif
 }
 
 void loop() {
-    // Wait for new clients from ROS and web servers
+    // Time this loop pass and the gap since the last shield poll for the metrics topic
+    unsigned long loopStartedAt = micros();
+    unsigned long pollGap = millis() - lastPollAt;
+    lastPollAt = millis();
+    if (pollGap > windowMaxPollGap) {
+        windowMaxPollGap = pollGap;
+    }
+
+    // Apply staged parameters between loop passes so no pass sees a mix
+    if (paramsApplyPending) {
+        ApplyParams();
+    }
+
+    // Wait for new clients from ROS and web servers; a slow poll here is what
+    // reconnecting clients see as accept latency
+    unsigned long acceptStartedAt = micros();
     PhpocClient ros_client = ros_server.available();
     PhpocClient web_client = web_server.available();
+    unsigned long acceptMicros = micros() - acceptStartedAt;
+    if (acceptMicros > windowMaxAcceptMicros) {
+        windowMaxAcceptMicros = acceptMicros;
+    }
 
     // If either client is connected
     if (ros_client || web_client) {
@@ -83,106 +493,33 @@ void loop() {
             alreadyConnected = true;
         }
 
+        // Read what both clients sent before running any of it. A Stop All found
+        // anywhere in this pass's input stops the station first; the stop byte is
+        // still run, and acknowledged once, in its place among the rest.
+        InputBurst rosInput;
+        InputBurst webInput;
+        ReadInputBurst(ros_client, 'g', rosInput);
+        ReadInputBurst(web_client, 'I', webInput);
+        stopAllThisPass = rosInput.stopRequested || webInput.stopRequested;
+        if (stopAllThisPass) {
+            AbortSequence();
+            StopAllMotors();
+        }
+
         // Handle incoming data from ROS client
-        if (ros_client.available() > 0) {
-            char command = ros_client.read();
-            switch (command) {
-                case 'a':
-                    Serial.println("ROS: Extend Plate");
-                    ExtendPlate();
-                    ros_server.write('A');  // Acknowledge command
-                    break;
-                case 'b':
-                    Serial.println("ROS: Retract Plate");
-                    RetractPlate();
-                    ros_server.write('B');
-                    break;
-                case 'c':
-                    Serial.println("ROS: Open Door");
-                    OpenDoor();
-                    ros_server.write('C');
-                    break;
-                case 'd':
-                    Serial.println("ROS: Close Door");
-                    CloseDoor();
-                    ros_server.write('D');
-                    break;
-                case 'e':
-                    Serial.println("ROS: Wireless Power On");
-                    wirelessPowerState = 0;  // Set state to on
-                    ros_server.write('E');
-                    break;
-                case 'f':
-                    Serial.println("ROS: Wireless Power Off");
-                    wirelessPowerState = 1;  // Set state to off
-                    ros_server.write('F');
-                    break;
-                case 'z':
-                    Serial.println("ROS: Take Off Sequence");
-                    TakeOffSequence();
-                    ros_server.write('Z');
-                    break;
-                case 'x':
-                    Serial.println("ROS: Landing Sequence");
-                    LandingSequence();
-                    ros_server.write('X');
-                    break;
-                case 'g':
-                    Serial.println("ROS: Stop All");
-                    StopAllMotors();
-                    ros_server.write('G');
-                    break;
-                default:
-                    Serial.println("Unknown ROS command");
-                    break;
+        for (uint8_t i = 0; i < rosInput.length; i++) {
+            if (!HandleRosCommand(ros_client, rosInput.bytes[i])) {
+                break;  // Turned away; the rest of its input is dropped
             }
         }
 
         // Handle incoming data from web client
-        if (web_client.available() > 0) {
-            char command = web_client.read();
-            switch (command) {
-                case 'A':
-                    Serial.println("Web: Extend Plate");
-                    ExtendPlate();
-                    break;
-                case 'D':
-                    Serial.println("Web: Retract Plate");
-                    RetractPlate();
-                    break;
-                case 'B':
-                    Serial.println("Web: Open Door");
-                    OpenDoor();
-                    break;
-                case 'E':
-                    Serial.println("Web: Close Door");
-                    CloseDoor();
-                    break;
-                case 'C':
-                    Serial.println("Web: Wireless Power On");
-                    wirelessPowerState = 0;  // Set state to on
-                    break;
-                case 'F':
-                    Serial.println("Web: Wireless Power Off");
-                    wirelessPowerState = 1;  // Set state to off
-                    break;
-                case 'G':
-                    Serial.println("Web: Take Off Sequence");
-                    TakeOffSequence();
-                    break;
-                case 'H':
-                    Serial.println("Web: Landing Sequence");
-                    LandingSequence();
-                    break;
-                case 'I':
-                    Serial.println("Web: Stop All");
-                    StopAllMotors();
-                    break;
-                default:
-                    Serial.println("Unknown Web command");
-                    break;
+        for (uint8_t i = 0; i < webInput.length; i++) {
+            if (!HandleWebCommand(web_client, webInput.bytes[i])) {
+                break;
             }
         }
+        stopAllThisPass = false;
     }
 
     // Control wireless power based on the state variable
@@ -191,60 +528,1289 @@ void loop() {
     } else {
         DisableWirelessPower();
     }
+
+    // Track door and plate positions, advance sequences and report readiness
+    UpdateFaultInjection();
+    CheckAxis(UpdateAxis(doorAxis, IsDoorHome(), DOOR_ENABLE_PIN), FAULT_DOOR_SENSOR_STUCK, FAULT_DOOR_SLOW);
+    CheckAxis(UpdateAxis(plateAxis, IsPlateHome(), PLATE_ENABLE_PIN), FAULT_PLATE_SENSOR_STUCK, FAULT_PLATE_SLOW);
+    UpdateSequence();
+    UpdateOperations();
+    UpdateRecovery();
+    PublishTopics();
+
+    // Roll the loop statistics over once a second
+    unsigned long loopMicros = micros() - loopStartedAt;
+    if (loopMicros > windowMaxLoopMicros) {
+        windowMaxLoopMicros = loopMicros;
+    }
+    windowLoopCount++;
+    if (millis() - metricsWindowStartedAt >= 1000) {
+        metricsWindowStartedAt = millis();
+        loopsPerSecond = windowLoopCount;
+        maxLoopMicros = windowMaxLoopMicros;
+        idlePermille = windowIdleMillis > 1000 ? 1000 : (unsigned int)windowIdleMillis;
+        maxWakeMicros = windowMaxWakeMicros;
+        maxPollGap = windowMaxPollGap;
+        maxAcceptMicros = windowMaxAcceptMicros;
+        busyCount = windowBusyCount;
+        windowLoopCount = 0;
+        windowMaxLoopMicros = 0;
+        windowIdleMillis = 0;
+        windowMaxWakeMicros = 0;
+        windowMaxPollGap = 0;
+        windowMaxAcceptMicros = 0;
+        windowBusyCount = 0;
+    }
+
+    // Nothing to do until the next poll (no client, no motion, no sequence and
+    // wireless power off): sleep instead of spinning, and time the wake-up
+    if (IsIdle()) {
+        unsigned long wakeMicros;
+        windowIdleMillis += IdleSleep(wakeMicros);
+        if (wakeMicros > windowMaxWakeMicros) {
+            windowMaxWakeMicros = wakeMicros;
+        }
+    }
+}
+
+// Function to read what a client has sent, up to INPUT_BURST_SIZE bytes, and note
+// whether it holds a Stop All outside a control line. A line carried over from
+// the last pass is followed to its end, the same way ReadControlLine will run it.
+void ReadInputBurst(PhpocClient& client, char stopCommand, InputBurst& burst) {
+    burst.length = 0;
+    burst.stopRequested = false;
+    if (!client || client.available() <= 0) {
+        return;
+    }
+    Subscriber* subscriber = FindSubscriber(client);
+    bool inLine = subscriber != nullptr && subscriber->lineLength > 0;
+    while (client.available() > 0 && burst.length < INPUT_BURST_SIZE) {
+        char c = client.read();
+        if (inLine) {
+            inLine = c != '\n';
+        } else if (c == '$') {
+            inLine = true;
+        } else if (c == stopCommand) {
+            burst.stopRequested = true;
+        }
+        burst.bytes[burst.length++] = c;
+    }
+}
+
+// Function to run a Stop All from the ROS ('g', acknowledged with 'G') or web
+// ('I') client
+void RunStopAll(bool fromRos) {
+    Serial.println(fromRos ? "ROS: Stop All" : "Web: Stop All");
+    AbortSequence();
+    StopAllMotors();
+    if (fromRos) {
+        ros_server.write('G');
+    }
+}
+
+// Function to refuse a motion command that arrived in the same pass as a Stop
+// All, so the stop wins whatever order the two were read in. Returns true when
+// the command was refused.
+bool RefuseForStopAll(PhpocClient& client, char command, const char* motionCommands) {
+    if (!stopAllThisPass || strchr(motionCommands, command) == nullptr) {
+        return false;
+    }
+    ReportInterlock(client, command, REASON_STOP_ALL);
+    return true;
+}
+
+// Function to run one byte received from the ROS client: part of a control line,
+// or a single-letter command. Returns false when the client was turned away.
+bool HandleRosCommand(PhpocClient& ros_client, char command) {
+    Subscriber* subscriber = FindSubscriber(ros_client);
+    // '$' starts a control line (subscriptions); anything else is a command.
+    // A "$CMD" line carries a command of its own unless its key was seen before.
+    if (ReadControlLine(subscriber, command)) {
+        command = TakeKeyedCommand(subscriber);
+    } else if (RejectControlLine(ros_client, subscriber, command)) {
+        return false;
+    }
+    if (command != 0) {
+        NoteCommandAccepted();
+        if (RefuseForStopAll(ros_client, command, "abcdzx")) {
+            command = 0;
+        }
+    }
+    switch (command) {
+        case 0:
+            break;
+        case 'a':
+            Serial.println("ROS: Extend Plate");
+            if (ReportInterlock(ros_client, 'a', ExtendPlate())) {
+                AbortSequence();  // Only an accepted command replaces the sequence
+                ros_server.write('A');  // Acknowledge command as accepted
+                StartOperation(OP_PLATE, 'a', ros_client, POSITION_OUT);
+            }
+            break;
+        case 'b':
+            Serial.println("ROS: Retract Plate");
+            if (ReportInterlock(ros_client, 'b', RetractPlate())) {
+                AbortSequence();
+                ros_server.write('B');  // Acknowledge command as accepted
+                StartOperation(OP_PLATE, 'b', ros_client, POSITION_HOME);
+            }
+            break;
+        case 'c':
+            Serial.println("ROS: Open Door");
+            if (ReportInterlock(ros_client, 'c', OpenDoor())) {
+                AbortSequence();
+                ros_server.write('C');  // Acknowledge command as accepted
+                StartOperation(OP_DOOR, 'c', ros_client, POSITION_OUT);
+            }
+            break;
+        case 'd':
+            Serial.println("ROS: Close Door");
+            if (ReportInterlock(ros_client, 'd', CloseDoor())) {
+                AbortSequence();
+                ros_server.write('D');  // Acknowledge command as accepted
+                StartOperation(OP_DOOR, 'd', ros_client, POSITION_HOME);
+            }
+            break;
+        case 'e':
+            Serial.println("ROS: Wireless Power On");
+            if (ReportInterlock(ros_client, 'e', CheckInterlock(INTERLOCK_WPT_ON))) {
+                wirelessPowerState = 0;  // Set state to on
+                ros_server.write('E');
+            }
+            break;
+        case 'f':
+            Serial.println("ROS: Wireless Power Off");
+            wirelessPowerState = 1;  // Set state to off
+            ros_server.write('F');
+            break;
+        case 'z':
+            Serial.println("ROS: Take Off Sequence");
+            TakeOffSequence();
+            ros_server.write('Z');  // Accepted; $DONE follows on completion
+            StartOperation(OP_SEQUENCE, 'z', ros_client, POSITION_OUT);
+            break;
+        case 'x':
+            Serial.println("ROS: Landing Sequence");
+            LandingSequence();
+            ros_server.write('X');  // Accepted; $DONE follows on completion
+            StartOperation(OP_SEQUENCE, 'x', ros_client, POSITION_HOME);
+            break;
+        case 'g':
+            RunStopAll(true);
+            break;
+        default:
+            Serial.println("Unknown ROS command");
+            break;
+    }
+    currentJournalEntry = NO_JOURNAL_ENTRY;
+    return true;
+}
+
+// Function to run one byte received from the web client. Returns false when the
+// client was turned away.
+bool HandleWebCommand(PhpocClient& web_client, char command) {
+    Subscriber* subscriber = FindSubscriber(web_client);
+    if (ReadControlLine(subscriber, command)) {
+        command = TakeKeyedCommand(subscriber);
+    } else if (RejectControlLine(web_client, subscriber, command)) {
+        return false;
+    }
+    if (command != 0) {
+        NoteCommandAccepted();
+        if (RefuseForStopAll(web_client, command, "ABDEGH")) {
+            command = 0;
+        }
+    }
+    switch (command) {
+        case 0:
+            break;
+        case 'A':
+            Serial.println("Web: Extend Plate");
+            if (ReportInterlock(web_client, 'A', ExtendPlate())) {
+                AbortSequence();  // Only an accepted command replaces the sequence
+                StartOperation(OP_PLATE, 'A', web_client, POSITION_OUT);
+            }
+            break;
+        case 'D':
+            Serial.println("Web: Retract Plate");
+            if (ReportInterlock(web_client, 'D', RetractPlate())) {
+                AbortSequence();
+                StartOperation(OP_PLATE, 'D', web_client, POSITION_HOME);
+            }
+            break;
+        case 'B':
+            Serial.println("Web: Open Door");
+            if (ReportInterlock(web_client, 'B', OpenDoor())) {
+                AbortSequence();
+                StartOperation(OP_DOOR, 'B', web_client, POSITION_OUT);
+            }
+            break;
+        case 'E':
+            Serial.println("Web: Close Door");
+            if (ReportInterlock(web_client, 'E', CloseDoor())) {
+                AbortSequence();
+                StartOperation(OP_DOOR, 'E', web_client, POSITION_HOME);
+            }
+            break;
+        case 'C':
+            Serial.println("Web: Wireless Power On");
+            if (ReportInterlock(web_client, 'C', CheckInterlock(INTERLOCK_WPT_ON))) {
+                wirelessPowerState = 0;  // Set state to on
+            }
+            break;
+        case 'F':
+            Serial.println("Web: Wireless Power Off");
+            wirelessPowerState = 1;  // Set state to off
+            break;
+        case 'G':
+            Serial.println("Web: Take Off Sequence");
+            TakeOffSequence();
+            StartOperation(OP_SEQUENCE, 'G', web_client, POSITION_OUT);
+            break;
+        case 'H':
+            Serial.println("Web: Landing Sequence");
+            LandingSequence();
+            StartOperation(OP_SEQUENCE, 'H', web_client, POSITION_HOME);
+            break;
+        case 'I':
+            RunStopAll(false);
+            break;
+        default:
+            Serial.println("Unknown Web command");
+            break;
+    }
+    currentJournalEntry = NO_JOURNAL_ENTRY;
+    return true;
+}
+
+// Function to decide whether the loop may sleep: no subscribed client, no motor
+// enabled, no estimated motion, no sequence, wireless power off and nothing staged
+bool IsIdle() {
+    if (IsAnyMotorEnabled() || doorAxis.motion != AXIS_STOPPED || plateAxis.motion != AXIS_STOPPED
+            || sequencePhase != SEQ_IDLE || wirelessPowerState == 0 || paramsApplyPending) {
+        return false;
+    }
+    for (uint8_t i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].active) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to read the motor enable pins. The pins, not the position estimates,
+// tell whether a motor runs: a timed move can end its estimate while the motor
+// is still enabled.
+bool IsAnyMotorEnabled() {
+    return digitalRead(DOOR_ENABLE_PIN) == (int)params[PARAM_MOTOR_ENABLE_LEVEL]
+        || digitalRead(PLATE_ENABLE_PIN) == (int)params[PARAM_MOTOR_ENABLE_LEVEL];
+}
+
+// Function to start tracking a move of an axis from its current position estimate
+void StartAxisMove(AxisState& axis, AxisMotion motion) {
+    axis.motion = motion;
+    axis.moveStartedAt = millis();
+    axis.startPosition = axis.position;
+    axis.slowReported = false;
 }
 
 // Function to stop all motors by disabling them
 void StopAllMotors() {
-    digitalWrite(DOOR_ENABLE_PIN, HIGH);   // Disable door motor
-    digitalWrite(PLATE_ENABLE_PIN, HIGH);  // Disable plate motor
+    StopAxisMotor(doorAxis, DOOR_ENABLE_PIN);
+    StopAxisMotor(plateAxis, PLATE_ENABLE_PIN);
+}
+
+// Function to stop one motor by disabling it
+void StopAxisMotor(AxisState& axis, int enablePin) {
+    digitalWrite(enablePin, !params[PARAM_MOTOR_ENABLE_LEVEL]);  // Disable the motor
+    axis.motion = AXIS_STOPPED;            // Freeze the position estimate where it is
 }
 
 // Function to start closing the door
-void CloseDoor() {
+uint8_t CloseDoor() {
+    uint8_t reason = CheckInterlock(INTERLOCK_CLOSE_DOOR);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(DOOR_DIRECTION_PIN, HIGH);  // Set direction to close
-    digitalWrite(DOOR_ENABLE_PIN, LOW);      // Enable motor
+    digitalWrite(DOOR_ENABLE_PIN, params[PARAM_MOTOR_ENABLE_LEVEL]);    // Enable motor
+    StartAxisMove(doorAxis, AXIS_HOMING);
+    return REASON_OK;
 }
 
 // Function to start opening the door
-void OpenDoor() {
+uint8_t OpenDoor() {
+    uint8_t reason = CheckInterlock(INTERLOCK_OPEN_DOOR);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(DOOR_DIRECTION_PIN, LOW);   // Set direction to open
-    digitalWrite(DOOR_ENABLE_PIN, LOW);      // Enable motor
+    digitalWrite(DOOR_ENABLE_PIN, params[PARAM_MOTOR_ENABLE_LEVEL]);    // Enable motor
+    StartAxisMove(doorAxis, AXIS_OUTBOUND);
+    return REASON_OK;
 }
 
 // Function to start retracting the landing plate (move in)
-void RetractPlate() {
+uint8_t RetractPlate() {
+    uint8_t reason = CheckInterlock(INTERLOCK_RETRACT_PLATE);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(PLATE_DIRECTION_PIN, HIGH); // Set direction to retract (in)
-    digitalWrite(PLATE_ENABLE_PIN, LOW);     // Enable motor
+    digitalWrite(PLATE_ENABLE_PIN, params[PARAM_MOTOR_ENABLE_LEVEL]);   // Enable motor
+    StartAxisMove(plateAxis, AXIS_HOMING);
+    return REASON_OK;
 }
 
 // Function to start extending the landing plate (move out)
-void ExtendPlate() {
+uint8_t ExtendPlate() {
+    uint8_t reason = CheckInterlock(INTERLOCK_EXTEND_PLATE);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(PLATE_DIRECTION_PIN, LOW);  // Set direction to extend (out)
-    digitalWrite(PLATE_ENABLE_PIN, LOW);     // Enable motor
+    digitalWrite(PLATE_ENABLE_PIN, params[PARAM_MOTOR_ENABLE_LEVEL]);   // Enable motor
+    StartAxisMove(plateAxis, AXIS_OUTBOUND);
+    return REASON_OK;
 }
 
-// Function to execute the takeoff sequence: open door, wait, then extend plate
+// Function to start the takeoff sequence: open door, then extend plate.
+// The sequence is advanced by UpdateSequence() so loop() keeps serving clients.
 void TakeOffSequence() {
-    OpenDoor();          // Start opening the door
-    delay(DOOR_TIME);    // Wait for door to fully open
-    ExtendPlate();       // Start extending the plate
-    delay(PLATE_TIME);   // Wait for plate to fully extend
+    wirelessPowerState = 1;            // The plate may not move while charging
+    DisableWirelessPower();
+    OpenDoor();                        // Start opening the door
+    sequencePhase = SEQ_TAKEOFF_DOOR;
+    sequencePhaseStartedAt = millis();
+    sequenceFinished = false;
 }
 
-// Function to execute the landing sequence: retract plate, wait, then close door
+// Function to start the landing sequence: retract plate, then close door
 void LandingSequence() {
-    RetractPlate();      // Start retracting the plate
-    delay(PLATE_TIME);   // Wait for plate to fully retract
-    CloseDoor();         // Start closing the door
-    delay(DOOR_TIME);    // Wait for door to fully close
+    wirelessPowerState = 1;
+    DisableWirelessPower();
+    RetractPlate();                    // Start retracting the plate
+    sequencePhase = SEQ_LANDING_PLATE;
+    sequencePhaseStartedAt = millis();
+    sequenceFinished = false;
+}
+
+// Function to abandon a running sequence; callers decide what the motors do
+void AbortSequence() {
+    sequencePhase = SEQ_IDLE;
+}
+
+// Function to advance an axis position estimate from elapsed time and its home sensor.
+// A homing move that ends on the sensor stops its motor, so the plate no longer
+// counts as running for the interlock once it is in; a full one updates the
+// learned homing time. Returns AXIS_SENSOR_STUCK or AXIS_SLOW (once per move)
+// when the move misbehaves.
+uint8_t UpdateAxis(AxisState& axis, bool isHome, int enablePin) {
+    unsigned long elapsed = millis() - axis.moveStartedAt;
+
+    if (axis.motion == AXIS_OUTBOUND && isHome && axis.startPosition == POSITION_HOME
+            && elapsed >= SENSOR_CLEAR_TIME) {
+        return AXIS_SENSOR_STUCK;
+    }
+    if (axis.motion == AXIS_HOMING && !isHome && !axis.slowReported
+            && elapsed >= axis.homingTime + axis.homingTime / 2) {
+        axis.slowReported = true;
+        return AXIS_SLOW;
+    }
+
+    if (axis.motion == AXIS_HOMING) {
+        if (isHome) {
+            // Learn from moves that covered the full travel (moving average, 1/4 weight)
+            if (axis.startPosition == POSITION_OUT) {
+                axis.homingTime = (axis.homingTime * 3 + elapsed) / 4;
+            }
+            axis.position = POSITION_HOME;
+            StopAxisMotor(axis, enablePin);
+        } else {
+            long travelled = elapsed >= axis.homingTime ? POSITION_OUT
+                                                        : (long)(elapsed * POSITION_OUT / axis.homingTime);
+            long position = axis.startPosition - travelled;
+            // Without the sensor the axis is never assumed fully home
+            axis.position = position < POSITION_HOME + 1 ? POSITION_HOME + 1 : (int)position;
+        }
+    } else if (axis.motion == AXIS_OUTBOUND) {
+        long travelled = elapsed >= axis.outboundTime ? POSITION_OUT
+                                                      : (long)(elapsed * POSITION_OUT / axis.outboundTime);
+        long position = axis.startPosition + travelled;
+        if (position >= POSITION_OUT) {
+            axis.position = POSITION_OUT;
+            axis.motion = AXIS_STOPPED;
+        } else {
+            axis.position = (int)position;
+        }
+    }
+    return AXIS_OK;
+}
+
+// Function to act on an axis check: a stuck sensor means the station no longer
+// knows where the axis is, so everything stops; a slow move is only reported
+void CheckAxis(uint8_t check, uint8_t stuckFault, uint8_t slowFault) {
+    if (check == AXIS_SENSOR_STUCK) {
+        RaiseFault(stuckFault);
+        AbortSequence();
+        StopAllMotors();
+    } else if (check == AXIS_SLOW) {
+        RaiseFault(slowFault);
+    }
+}
+
+// Function to advance the running sequence. Outbound phases end when the
+// position estimate reaches the out end; homing phases end on the home sensor,
+// or after the full operation time if the sensor never reports, with that
+// axis's motor stopped. A step the interlock refuses ends the sequence and
+// stops both motors, as a stuck sensor does.
+void UpdateSequence() {
+    unsigned long elapsed = millis() - sequencePhaseStartedAt;
+
+    switch (sequencePhase) {
+        case SEQ_TAKEOFF_DOOR:
+            if (doorAxis.position == POSITION_OUT) {
+                if (ExtendPlate() != REASON_OK) {
+                    RaiseFault(FAULT_SEQUENCE_INTERLOCK);
+                    AbortSequence();
+                    StopAllMotors();
+                    break;
+                }
+                operations[OP_SEQUENCE].phaseTime[0] = elapsed;
+                sequencePhase = SEQ_TAKEOFF_PLATE;
+                sequencePhaseStartedAt = millis();
+                ReportProgress();
+            }
+            break;
+        case SEQ_TAKEOFF_PLATE:
+            if (plateAxis.position == POSITION_OUT) {
+                operations[OP_SEQUENCE].phaseTime[1] = elapsed;
+                sequencePhase = SEQ_IDLE;
+                sequenceFinished = true;
+            }
+            break;
+        case SEQ_LANDING_PLATE:
+            if (plateAxis.position == POSITION_HOME || elapsed >= params[PARAM_PLATE_TIME]) {
+                if (plateAxis.position != POSITION_HOME) {
+                    StopAxisMotor(plateAxis, PLATE_ENABLE_PIN);
+                    RaiseFault(FAULT_PLATE_HOME_TIMEOUT);
+                }
+                // The interlock refuses to close the door unless the plate sensor reports in
+                if (CloseDoor() != REASON_OK) {
+                    RaiseFault(FAULT_SEQUENCE_INTERLOCK);
+                    AbortSequence();
+                    StopAllMotors();
+                    break;
+                }
+                operations[OP_SEQUENCE].phaseTime[0] = elapsed;
+                sequencePhase = SEQ_LANDING_DOOR;
+                sequencePhaseStartedAt = millis();
+                ReportProgress();
+            }
+            break;
+        case SEQ_LANDING_DOOR:
+            if (doorAxis.position == POSITION_HOME || elapsed >= params[PARAM_DOOR_TIME]) {
+                if (doorAxis.position != POSITION_HOME) {
+                    StopAxisMotor(doorAxis, DOOR_ENABLE_PIN);
+                    RaiseFault(FAULT_DOOR_HOME_TIMEOUT);
+                }
+                operations[OP_SEQUENCE].phaseTime[1] = elapsed;
+                sequencePhase = SEQ_IDLE;
+                sequenceFinished = true;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Function to send the completion event of an operation and free its slot:
+// "$DONE,<cmd>,<result>,<fault>,<door pos>,<plate pos>,<door home>,<plate home>,<t1>,<t2>,<id>\n"
+// <fault> is the fault that ended it when <result> is DONE_FAULT, else 0; <t1>/<t2> are the
+// measured move time, or the two phase times of a sequence, in milliseconds.
+void CompleteOperation(uint8_t slot, uint8_t result) {
+    Operation& operation = operations[slot];
+    operation.active = false;
+    for (uint8_t i = 0; i < JOURNAL_SIZE; i++) {
+        if (journal[i].key != 0 && journal[i].operationId == operation.id) {
+            journal[i].result = result;   // Replayed to retries of its keyed command
+        }
+    }
+
+    char line[72];
+    int length = snprintf(line, sizeof(line), "$DONE,%c,%u,%u,%d,%d,%u,%u,%lu,%lu,%u\n",
+                          operation.command, result, (unsigned)operation.fault,
+                          doorAxis.position, plateAxis.position,
+                          IsDoorHome() ? 1u : 0u, IsPlateHome() ? 1u : 0u,
+                          operation.phaseTime[0], operation.phaseTime[1], operation.id);
+    SendEvent(operation.client, line, length);
+}
+
+// Function to tell a client its command was accepted and which id it got:
+// "$ACK,<cmd>,<id>\n". ROS clients also keep their legacy acknowledgement letter.
+void AcknowledgeCommand(PhpocClient& client, char command, uint16_t id) {
+    char line[16];
+    int length = snprintf(line, sizeof(line), "$ACK,%c,%u\n", command, id);
+    SendEvent(client, line, length);
+}
+
+// Function to send an operation event line to a client that speaks the event
+// protocol. Clients without a slot, and legacy clients that have never sent a
+// "$..." line, get nothing.
+void SendEvent(PhpocClient& client, const char* line, int length) {
+    for (uint8_t i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].active && subscribers[i].client == client && subscribers[i].eventProtocol) {
+            client.write((const uint8_t*)line, length);
+            return;
+        }
+    }
+}
+
+// Function to track an accepted motion command until its completion. An axis
+// command supersedes a running sequence and vice versa.
+void StartOperation(uint8_t slot, char command, PhpocClient& client, int target) {
+    for (uint8_t i = 0; i < OP_SLOT_COUNT; i++) {
+        bool conflicts = i == slot || slot == OP_SEQUENCE || i == OP_SEQUENCE;
+        if (operations[i].active && conflicts) {
+            CompleteOperation(i, DONE_SUPERSEDED);
+        }
+    }
+    Operation& operation = operations[slot];
+    operation.active = true;
+    operation.id = nextOperationId++;
+    if (nextOperationId == 0) {
+        nextOperationId = 1;    // 0 is never a valid id
+    }
+    operation.command = command;
+    operation.client = client;
+    operation.target = target;
+    operation.startedAt = millis();
+    operation.phaseTime[0] = 0;
+    operation.phaseTime[1] = 0;
+    operation.fault = FAULT_NONE;
+    if (currentJournalEntry != NO_JOURNAL_ENTRY) {
+        journal[currentJournalEntry].operationId = operation.id;
+        journal[currentJournalEntry].result = JOURNAL_RUNNING;
+    }
+    AcknowledgeCommand(client, command, operation.id);
+    if (slot == OP_SEQUENCE) {
+        ReportProgress();
+    }
+}
+
+// Function to cancel one operation by id. Only the motors the operation owns are
+// disabled, leaving each axis where it is; other clients' moves keep running.
+// Only the client that started an operation may cancel it. Returns false when
+// no running operation has that id or it belongs to another client.
+bool CancelOperation(uint16_t id, PhpocClient& requester) {
+    for (uint8_t slot = 0; slot < OP_SLOT_COUNT; slot++) {
+        if (!operations[slot].active || operations[slot].id != id
+                || !(operations[slot].client == requester)) {
+            continue;
+        }
+        if (slot == OP_SEQUENCE) {
+            AbortSequence();
+        }
+        if (slot != OP_PLATE) {
+            StopAxisMotor(doorAxis, DOOR_ENABLE_PIN);
+        }
+        if (slot != OP_DOOR) {
+            StopAxisMotor(plateAxis, PLATE_ENABLE_PIN);
+        }
+        CompleteOperation(slot, DONE_CANCELLED);
+        return true;
+    }
+    return false;
+}
+
+// Function to send completions for operations whose axis or sequence has come
+// to rest. An operation that saw a fault completes as DONE_FAULT; one that
+// rests short of its target was stopped.
+void UpdateOperations() {
+    for (uint8_t slot = 0; slot < OP_SLOT_COUNT; slot++) {
+        Operation& operation = operations[slot];
+        if (!operation.active) {
+            continue;
+        }
+        if (slot == OP_SEQUENCE) {
+            if (sequencePhase == SEQ_IDLE) {
+                CompleteOperation(slot, operation.fault != FAULT_NONE ? DONE_FAULT : sequenceFinished ? DONE_OK : DONE_STOPPED);
+            }
+            continue;
+        }
+        AxisState& axis = slot == OP_DOOR ? doorAxis : plateAxis;
+        // A close or retract whose home sensor never reports gets the same
+        // timeout as the sequence phases, then its motor is stopped
+        unsigned long timeout = params[slot == OP_DOOR ? PARAM_DOOR_TIME : PARAM_PLATE_TIME];
+        if (axis.motion == AXIS_HOMING && millis() - operation.startedAt >= timeout) {
+            StopAxisMotor(axis, slot == OP_DOOR ? DOOR_ENABLE_PIN : PLATE_ENABLE_PIN);
+            RaiseFault(slot == OP_DOOR ? FAULT_DOOR_HOME_TIMEOUT : FAULT_PLATE_HOME_TIMEOUT);
+        }
+        if (axis.motion == AXIS_STOPPED) {
+            operation.phaseTime[0] = millis() - operation.startedAt;
+            CompleteOperation(slot, operation.fault != FAULT_NONE ? DONE_FAULT
+                                  : axis.position == operation.target ? DONE_OK : DONE_STOPPED);
+        }
+    }
+}
+
+// Function to estimate the remaining time in milliseconds to move an axis to a target end
+unsigned long RemainingTravelTime(const AxisState& axis, int target) {
+    if (target == POSITION_OUT) {
+        return (unsigned long)(POSITION_OUT - axis.position) * axis.outboundTime / POSITION_OUT;
+    }
+    return (unsigned long)(axis.position - POSITION_HOME) * axis.homingTime / POSITION_OUT;
+}
+
+// Function to send the progress of the running sequence to the client that started it:
+// "$PRG,<id>,<phase>,<remaining ms>\n", sent on acceptance and at each phase boundary.
+void ReportProgress() {
+    Operation& operation = operations[OP_SEQUENCE];
+    if (!operation.active) {
+        return;
+    }
+    // Door opens before the plate extends; the plate retracts before the door closes
+    int target = operation.target;
+    unsigned long remaining = RemainingTravelTime(doorAxis, target)
+                            + RemainingTravelTime(plateAxis, target);
+    char line[32];
+    int length = snprintf(line, sizeof(line), "$PRG,%u,%u,%lu\n",
+                          operation.id, (unsigned)sequencePhase, remaining);
+    SendEvent(operation.client, line, length);
+}
+
+// Function to pack the sensors, motor pins and relay state into an interlock
+// state byte. A motor runs while its enable pin is active, whatever the position
+// estimate says: a timed move ends its estimate with the motor still enabled.
+// Direction HIGH closes the door / retracts the plate.
+uint8_t ReadInterlockState() {
+    int enableLevel = (int)params[PARAM_MOTOR_ENABLE_LEVEL];
+    return (IsDoorHome() ? STATE_DOOR_CLOSED : 0)
+         | (IsPlateHome() ? STATE_PLATE_IN : 0)
+         | (digitalRead(DOOR_ENABLE_PIN) == enableLevel ? STATE_DOOR_RUNNING : 0)
+         | (digitalRead(DOOR_DIRECTION_PIN) == HIGH ? STATE_DOOR_CLOSING : 0)
+         | (digitalRead(PLATE_ENABLE_PIN) == enableLevel ? STATE_PLATE_RUNNING : 0)
+         | (digitalRead(PLATE_DIRECTION_PIN) == HIGH ? STATE_PLATE_RETRACTING : 0)
+         | (wirelessPowerState == 0 ? STATE_WPT_ON : 0);
+}
+
+// Function to check an actuator command against the current state
+uint8_t CheckInterlock(uint8_t command) {
+    return InterlockLookup(ReadInterlockState(), command);
+}
+
+// Function to tell a client that a command was refused, as "$DENY,<command>,<reason>\n".
+// A legacy client only sees the missing acknowledgement letter. Returns true
+// when the command was allowed and nothing was sent.
+bool ReportInterlock(PhpocClient& client, char command, uint8_t reason) {
+    if (reason == REASON_OK) {
+        return true;
+    }
+    if (currentJournalEntry != NO_JOURNAL_ENTRY) {
+        journal[currentJournalEntry].reason = reason;
+    }
+    char line[20];
+    int length = snprintf(line, sizeof(line), "$DENY,%c,%u\n", command, reason);
+    SendEvent(client, line, length);
+    return false;
+}
+
+// Function to mark the running operations a fault belongs to: door faults end
+// a door operation, plate faults a plate operation, and a sequence owns both
+// axes plus its own interlock and session faults. Only the first fault counts.
+void AttributeFault(uint8_t fault) {
+    bool door = fault == FAULT_DOOR_HOME_TIMEOUT || fault == FAULT_DOOR_SENSOR_STUCK
+             || fault == FAULT_DOOR_SLOW;
+    bool plate = fault == FAULT_PLATE_HOME_TIMEOUT || fault == FAULT_PLATE_SENSOR_STUCK
+              || fault == FAULT_PLATE_SLOW;
+    bool sequence = door || plate || fault == FAULT_SEQUENCE_INTERLOCK
+                 || fault == FAULT_SESSION_LOST;
+    bool owns[OP_SLOT_COUNT] = { door, plate, sequence };
+    for (uint8_t slot = 0; slot < OP_SLOT_COUNT; slot++) {
+        if (owns[slot] && operations[slot].active && operations[slot].fault == FAULT_NONE) {
+            operations[slot].fault = fault;
+        }
+    }
+}
+
+// Function to record a fault for the faults topic and start its recovery timeline
+void RaiseFault(uint8_t fault) {
+    lastFault = fault;
+    faultCount++;
+    AttributeFault(fault);
+    Serial.print("Fault ");
+    Serial.println(fault);
+
+    recovery.startedAt = millis();
+#if defined(STATION_FAULT_INJECTION)
+    if (activeFault != INJECT_NONE) {
+        recovery.startedAt = injectedAt;
+    }
+#endif
+    recovery.detectTime = millis() - recovery.startedAt;
+    recovery.safe = false;
+    recovery.resumed = false;
+}
+
+// Function to mark the safe state of the last fault once no motor is enabled,
+// no axis is estimated to move and no sequence runs
+void UpdateRecovery() {
+    if (!recovery.safe && !IsAnyMotorEnabled() && doorAxis.motion == AXIS_STOPPED
+            && plateAxis.motion == AXIS_STOPPED && sequencePhase == SEQ_IDLE) {
+        recovery.safe = true;
+        recovery.safeTime = millis() - recovery.startedAt;
+    }
+}
+
+// Function to mark the resumption of the last fault when a command arrives after it is safe
+void NoteCommandAccepted() {
+    if (recovery.safe && !recovery.resumed) {
+        recovery.resumed = true;
+        recovery.resumeTime = millis() - recovery.startedAt;
+    }
+}
+
+// Function to release the slot of a client that went away. Losing the client
+// that started a running sequence is a fault: the sequence carries on, but it
+// no longer hears about its completion. Other clients may come and go.
+void ReleaseSubscriber(Subscriber& subscriber) {
+    subscriber.active = false;
+    if (sequencePhase != SEQ_IDLE && operations[OP_SEQUENCE].active
+            && subscriber.client == operations[OP_SEQUENCE].client) {
+        RaiseFault(FAULT_SESSION_LOST);
+    }
+}
+
+#if defined(STATION_FAULT_INJECTION)
+// Function to inject a scheduled fault once its delay has passed
+void UpdateFaultInjection() {
+    if (scheduledFault == INJECT_NONE || millis() - scheduledAt < scheduledDelay) {
+        return;
+    }
+    activeFault = scheduledFault;
+    scheduledFault = INJECT_NONE;
+    injectedAt = millis();
+    Serial.print("Injected fault ");
+    Serial.println(activeFault);
+
+    switch (activeFault) {
+        case INJECT_DOOR_SENSOR_STUCK:
+            stuckReading = digitalRead(DOOR_PHOTO_PIN);
+            break;
+        case INJECT_PLATE_SENSOR_STUCK:
+            stuckReading = digitalRead(PLATE_PHOTO_PIN);
+            break;
+        case INJECT_SESSION_DROP:
+            for (uint8_t i = 0; i < MAX_SUBSCRIBERS; i++) {
+                if (subscribers[i].active) {
+                    subscribers[i].client.stop();
+                    ReleaseSubscriber(subscribers[i]);
+                }
+            }
+            activeFault = INJECT_NONE;
+            break;
+        case INJECT_RESET:
+            resetMarker = RESET_MARKER;
+            wdt_enable(WDTO_15MS);
+            for (;;) {
+                // Wait for the watchdog to reset the MCU
+            }
+        default:
+            break;
+    }
+}
+
+// Function to schedule an injection: "$INJ,<fault>,<delay ms>", fault 255 picks
+// a fault and a delay below <delay ms> at random, fault 0 clears any injection
+bool ScheduleFaultInjection(unsigned long fault, unsigned long delayMs) {
+    if (fault == INJECT_RANDOM) {
+        fault = random(INJECT_NONE + 1, INJECT_COUNT);
+        delayMs = delayMs > 0 ? random(delayMs) : 0;
+    }
+    if (fault >= INJECT_COUNT) {
+        return false;
+    }
+    activeFault = INJECT_NONE;
+    scheduledFault = (uint8_t)fault;
+    scheduledAt = millis();
+    scheduledDelay = delayMs;
+    return true;
+}
+#else
+// Production images never inject faults
+void UpdateFaultInjection() {
+}
+#endif
+
+// Function to find the slot of a client, allocating a free one for a new client.
+// Slots of disconnected clients are released first. Returns nullptr when all
+// slots are taken; such a client can still send commands but not subscribe.
+Subscriber* FindSubscriber(PhpocClient& client) {
+    Subscriber* freeSlot = nullptr;
+    for (uint8_t i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber& subscriber = subscribers[i];
+        if (subscriber.active && !subscriber.client.connected()) {
+            ReleaseSubscriber(subscriber);
+        }
+        if (subscriber.active && subscriber.client == client) {
+            return &subscriber;
+        }
+        if (!subscriber.active && freeSlot == nullptr) {
+            freeSlot = &subscriber;
+        }
+    }
+    if (freeSlot != nullptr) {
+        *freeSlot = Subscriber();
+        freeSlot->active = true;
+        freeSlot->client = client;
+    }
+    return freeSlot;
+}
+
+// Function to send the capability descriptor, so a client can tell the station
+// variant and supported protocols without reading the serial console
+void SendCapabilities(PhpocClient& client) {
+    char line[48];
+    int length = snprintf(line, sizeof(line), "$CAP,%s,%s,%u,%u,%u,%u\n",
+                          STATION_VARIANT, FIRMWARE_VERSION, STATION_BAYS, STATION_HAS_WPT,
+                          LEGACY_PROTOCOL_VERSION, EVENT_PROTOCOL_VERSION);
+    client.write((const uint8_t*)line, length);
+}
+
+// Function to write one event line to a single client
+void SendLine(Subscriber& subscriber, const char* line) {
+    subscriber.client.write((const uint8_t*)line, strlen(line));
+}
+
+// Function to read a parameter descriptor from flash
+ParamInfo ReadParamInfo(uint8_t id) {
+    ParamInfo info;
+    memcpy_P(&info, &PARAM_INFO[id], sizeof(info));
+    return info;
+}
+
+// Function to check a parameter value against the type and range of its descriptor
+bool IsParamValid(uint8_t id, unsigned long value) {
+    ParamInfo info = ReadParamInfo(id);
+    if (info.type == PARAM_LEVEL) {
+        return value == LOW || value == HIGH;
+    }
+    return value >= info.minimum && value <= info.maximum;
+}
+
+// Function to compute the CRC of a stored parameter image (excluding the CRC itself)
+uint16_t StoredParamsCrc(const StoredParams& stored) {
+    const uint8_t* bytes = (const uint8_t*)&stored;
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < offsetof(StoredParams, crc); i++) {
+        crc = _crc16_update(crc, bytes[i]);
+    }
+    return crc;
+}
+
+// Function to load parameters from EEPROM. Each value is range-checked; a bad
+// CRC, an unknown layout or an out-of-range value falls back to the default.
+void LoadParams() {
+    StoredParams stored;
+    EEPROM.get(PARAMS_EEPROM_ADDRESS, stored);
+    bool valid = stored.magic == PARAMS_MAGIC && stored.crc == StoredParamsCrc(stored);
+
+    for (uint8_t id = 0; id < PARAM_COUNT; id++) {
+        unsigned long value = stored.values[id];
+        if (!valid || !IsParamValid(id, value)) {
+            value = ReadParamInfo(id).defaultValue;
+        }
+        params[id] = value;
+        stagedParams[id] = value;
+    }
+    doorAxis.outboundTime = doorAxis.homingTime = params[PARAM_DOOR_TIME];
+    plateAxis.outboundTime = plateAxis.homingTime = params[PARAM_PLATE_TIME];
+}
+
+// Function to store the active parameters to EEPROM (only changed bytes are written)
+void SaveParams() {
+    StoredParams stored;
+    stored.magic = PARAMS_MAGIC;
+    memcpy(stored.values, params, sizeof(stored.values));
+    stored.crc = StoredParamsCrc(stored);
+    EEPROM.put(PARAMS_EEPROM_ADDRESS, stored);
+}
+
+// Function to make the staged parameters active. A polarity change stops the
+// motors and any sequence first, because the pins are about to change meaning.
+void ApplyParams() {
+    paramsApplyPending = false;
+    bool polarityChanged = stagedParams[PARAM_MOTOR_ENABLE_LEVEL] != params[PARAM_MOTOR_ENABLE_LEVEL]
+                        || stagedParams[PARAM_WPT_ACTIVE_LEVEL] != params[PARAM_WPT_ACTIVE_LEVEL]
+                        || stagedParams[PARAM_SENSOR_HOME_LEVEL] != params[PARAM_SENSOR_HOME_LEVEL];
+    if (polarityChanged) {
+        AbortSequence();
+        StopAllMotors();
+    }
+
+    if (stagedParams[PARAM_DOOR_TIME] != params[PARAM_DOOR_TIME]) {
+        doorAxis.outboundTime = doorAxis.homingTime = stagedParams[PARAM_DOOR_TIME];
+    }
+    if (stagedParams[PARAM_PLATE_TIME] != params[PARAM_PLATE_TIME]) {
+        plateAxis.outboundTime = plateAxis.homingTime = stagedParams[PARAM_PLATE_TIME];
+    }
+    bool sensorLevelChanged = stagedParams[PARAM_SENSOR_HOME_LEVEL] != params[PARAM_SENSOR_HOME_LEVEL];
+    memcpy(params, stagedParams, sizeof(params));
+
+    if (polarityChanged) {
+        StopAllMotors();  // Drive the enable pins to the new idle level
+    }
+    if (sensorLevelChanged) {
+        SeedAxisPositions();  // The sensors were read with the old level until now
+    }
+}
+
+// Function to seed the position estimates from the home sensors, at boot and
+// when the sensor level changes; an axis that is not home is assumed fully out
+void SeedAxisPositions() {
+    doorAxis.position = IsDoorHome() ? POSITION_HOME : POSITION_OUT;
+    plateAxis.position = IsPlateHome() ? POSITION_HOME : POSITION_OUT;
+}
+
+// Function to read the door sensor; true when the door is closed
+bool IsDoorHome() {
+#if defined(STATION_FAULT_INJECTION)
+    if (activeFault == INJECT_DOOR_SENSOR_STUCK) {
+        return stuckReading == (int)params[PARAM_SENSOR_HOME_LEVEL];
+    }
+#endif
+    return digitalRead(DOOR_PHOTO_PIN) == (int)params[PARAM_SENSOR_HOME_LEVEL];
+}
+
+// Function to read the plate sensor; true when the plate is retracted
+bool IsPlateHome() {
+#if defined(STATION_FAULT_INJECTION)
+    if (activeFault == INJECT_PLATE_SENSOR_STUCK) {
+        return stuckReading == (int)params[PARAM_SENSOR_HOME_LEVEL];
+    }
+    // A slow motor reaches home only after twice the learned time
+    if (activeFault == INJECT_SLOW_PLATE && plateAxis.motion == AXIS_HOMING
+            && millis() - plateAxis.moveStartedAt < plateAxis.homingTime * 2) {
+        return false;
+    }
+#endif
+    return digitalRead(PLATE_PHOTO_PIN) == (int)params[PARAM_SENSOR_HOME_LEVEL];
+}
+
+// Function to find a topic by name; returns TOPIC_COUNT when unknown
+uint8_t FindTopic(const char* name) {
+    for (uint8_t i = 0; name != nullptr && i < TOPIC_COUNT; i++) {
+        if (strcmp(name, TOPIC_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return TOPIC_COUNT;
+}
+
+// Function to parse a field that must be a plain decimal number. Returns false
+// for a missing or empty field and for any trailing non-digit, so "abc" or
+// "1x" are refused rather than read as 0 or 1.
+bool ParseNumber(const char* field, unsigned long& value) {
+    if (field == nullptr || *field < '0' || *field > '9') {
+        return false;
+    }
+    char* end = nullptr;
+    value = strtoul(field, &end, 10);
+    return *end == '\0';
+}
+
+// Function to handle a complete control line:
+//   "$SUB,<topic>,<c|p>,<ms>" subscribes on change (rate limited) or periodically
+//   "$UNSUB,<topic>"          cancels a subscription
+//   "$PGET,<id>"              reads a parameter, answered with "$PRM,<id>,<active>,<staged>,<type>\n"
+//   "$PSET,<id>,<value>"      stages a parameter after checking its type and range
+//   "$PAPPLY"                 applies all staged parameters before the next loop pass
+//   "$PSAVE"                  persists the active parameters to EEPROM
+//   "$CAN,<id>"               cancels one running operation, stopping only its axes
+//   "$CMD,<key>,<c>"          runs command <c> once per key; repeats get "$DUP,..."
+//   "$CAP"                    sends the capability descriptor again
+//   "$INJ,<fault>,<delay ms>" schedules a fault (STATION_FAULT_INJECTION images only)
+// Other replies are "$OK,<verb>\n" or "$ERR,<verb>\n".
+void HandleControlLine(Subscriber& subscriber) {
+    // Split "$VERB,a,b,c" in place into up to four fields
+    char* fields[4] = { subscriber.line + 1, nullptr, nullptr, nullptr };
+    for (uint8_t i = 1; i < 4; i++) {
+        char* comma = strchr(fields[i - 1], ',');
+        if (comma == nullptr) {
+            break;
+        }
+        *comma = '\0';
+        fields[i] = comma + 1;
+    }
+    const char* verb = fields[0];
+    char reply[CONTROL_LINE_SIZE];
+    bool ok = false;
+
+    if (strcmp(verb, "SUB") == 0) {
+        uint8_t topic = FindTopic(fields[1]);
+        if (topic < TOPIC_COUNT && fields[3] != nullptr && (*fields[2] == 'c' || *fields[2] == 'p')) {
+            Subscription& subscription = subscriber.topics[topic];
+            unsigned long ms = strtoul(fields[3], nullptr, 10);
+            subscription.mode = *fields[2] == 'c' ? TOPIC_ON_CHANGE : TOPIC_PERIODIC;
+            subscription.interval = ms < MIN_TOPIC_INTERVAL ? MIN_TOPIC_INTERVAL
+                                  : ms > 60000 ? 60000 : (unsigned int)ms;
+            // Send the current state on the next pass
+            subscription.lastSentAt = millis() - subscription.interval;
+            subscription.lastKey = 0xFFFF;
+            ok = true;
+        }
+    } else if (strcmp(verb, "UNSUB") == 0) {
+        uint8_t topic = FindTopic(fields[1]);
+        if (topic < TOPIC_COUNT) {
+            subscriber.topics[topic].mode = TOPIC_OFF;
+            ok = true;
+        }
+    } else if (strcmp(verb, "PGET") == 0 || strcmp(verb, "PSET") == 0) {
+        unsigned long id = PARAM_COUNT;
+        if (!ParseNumber(fields[1], id)) {
+            id = PARAM_COUNT;
+        }
+        if (id < PARAM_COUNT && strcmp(verb, "PGET") == 0) {
+            snprintf(reply, sizeof(reply), "$PRM,%u,%lu,%lu,%s\n", (unsigned)id,
+                     params[id], stagedParams[id], PARAM_TYPE_NAMES[ReadParamInfo(id).type]);
+            SendLine(subscriber, reply);
+            return;
+        }
+        unsigned long value = 0;
+        if (id < PARAM_COUNT && ParseNumber(fields[2], value) && IsParamValid(id, value)) {
+            stagedParams[id] = value;
+            ok = true;
+        }
+    } else if (strcmp(verb, "PAPPLY") == 0) {
+        paramsApplyPending = true;
+        ok = true;
+    } else if (strcmp(verb, "PSAVE") == 0) {
+        SaveParams();
+        ok = true;
+    } else if (strcmp(verb, "CMD") == 0 && fields[2] != nullptr) {
+        unsigned long key = strtoul(fields[1], nullptr, 10);
+        if (key != 0 && *fields[2] != '\0') {
+            for (uint8_t i = 0; i < JOURNAL_SIZE; i++) {
+                const JournalEntry& entry = journal[i];
+                if (entry.key != key) {
+                    continue;
+                }
+                int length = snprintf(reply, sizeof(reply), "$DUP,%lu,%c,%u,%u,",
+                                      key, entry.command, entry.reason, entry.operationId);
+                if (entry.result == JOURNAL_RUNNING) {
+                    snprintf(reply + length, sizeof(reply) - length, "-\n");
+                } else {
+                    snprintf(reply + length, sizeof(reply) - length, "%u\n", entry.result);
+                }
+                SendLine(subscriber, reply);
+                return;
+            }
+            // New key: the command runs after this line, like a bare command letter
+            subscriber.keyedCommand = *fields[2];
+            subscriber.keyedCommandKey = key;
+            return;
+        }
+    } else if (strcmp(verb, "CAP") == 0) {
+        SendCapabilities(subscriber.client);
+        return;
+    } else if (strcmp(verb, "CAN") == 0 && fields[1] != nullptr) {
+        ok = CancelOperation((uint16_t)strtoul(fields[1], nullptr, 10), subscriber.client);
+#if defined(STATION_FAULT_INJECTION)
+    } else if (strcmp(verb, "INJ") == 0 && fields[2] != nullptr) {
+        ok = ScheduleFaultInjection(strtoul(fields[1], nullptr, 10), strtoul(fields[2], nullptr, 10));
+#endif
+    }
+
+    snprintf(reply, sizeof(reply), "$%s,%s\n", ok ? "OK" : "ERR", verb);
+    SendLine(subscriber, reply);
+}
+
+// Function to collect a control line one character per call. Returns true when
+// the character belongs to a control line and must not be run as a command.
+// Lines start with '$' and end with '\n' (a trailing '\r' is ignored).
+bool ReadControlLine(Subscriber* subscriber, char c) {
+    if (subscriber == nullptr || (subscriber->lineLength == 0 && c != '$')) {
+        return false;
+    }
+    if (c == '\n') {
+        subscriber->line[subscriber->lineLength] = '\0';
+        // The first line shows the client speaks the event protocol: it gets the
+        // capability descriptor before the answer, unless the line asks for it
+        if (!subscriber->eventProtocol) {
+            subscriber->eventProtocol = true;
+            if (strcmp(subscriber->line, "$CAP") != 0) {
+                SendCapabilities(subscriber->client);
+            }
+        }
+        HandleControlLine(*subscriber);
+        subscriber->lineLength = 0;
+    } else if (c != '\r' && subscriber->lineLength < CONTROL_LINE_SIZE - 1) {
+        subscriber->line[subscriber->lineLength++] = c;
+    }
+    return true;
+}
+
+// Function to take the command of a "$CMD" line that has just ended, recording a
+// journal entry for it. Returns 0 when there is none (other control lines, repeats).
+char TakeKeyedCommand(Subscriber* subscriber) {
+    char command = subscriber->keyedCommand;
+    if (command == 0) {
+        return 0;
+    }
+    subscriber->keyedCommand = 0;
+
+    JournalEntry& entry = journal[journalNext];
+    entry.key = subscriber->keyedCommandKey;
+    entry.command = command;
+    entry.reason = REASON_OK;
+    entry.operationId = 0;
+    entry.result = DONE_OK;
+    currentJournalEntry = journalNext;
+    journalNext = (journalNext + 1) % JOURNAL_SIZE;
+    return command;
+}
+
+// Function to turn away a client whose control line has no subscriber slot. The
+// rest of the line is discarded so none of its characters run as commands, and
+// the client is told when to retry. Returns true when the client was turned away.
+bool RejectControlLine(PhpocClient& client, Subscriber* subscriber, char c) {
+    if (subscriber != nullptr || c != '$') {
+        return false;
+    }
+    while (client.available() > 0 && client.read() != '\n') {
+    }
+    unsigned int scale = windowBusyCount + busyCount + 1;
+    if (scale > BUSY_RETRY_MAX_SCALE) {
+        scale = BUSY_RETRY_MAX_SCALE;
+    }
+    windowBusyCount++;
+    char line[24];
+    int length = snprintf(line, sizeof(line), "$BUSY,%lu\n",
+                          BUSY_RETRY_MIN + random(BUSY_RETRY_MIN * scale));
+    client.write((const uint8_t*)line, length);
+    client.stop();
+    return true;
+}
+
+// Function to compute a cheap key that changes whenever a topic's content changes
+// enough to be worth an on-change update. Axis keys move in steps of 1% of travel.
+uint16_t TopicChangeKey(uint8_t topic) {
+    switch (topic) {
+        case TOPIC_DOOR:
+            return (doorAxis.motion << 12) | (IsDoorHome() << 11)
+                 | (doorAxis.position / 10);
+        case TOPIC_PLATE:
+            return (plateAxis.motion << 12) | (IsPlateHome() << 11)
+                 | (plateAxis.position / 10);
+        case TOPIC_WPT:
+            return wirelessPowerState;
+        case TOPIC_FAULTS:
+            return (faultCount << 2) | (recovery.safe << 1) | recovery.resumed;
+        case TOPIC_METRICS:
+            return (uint16_t)(metricsWindowStartedAt / 1000);
+        default:
+            return (sequencePhase << 1) | (wirelessPowerState == 0);
+    }
+}
+
+// Function to append a recovery stage time, or "-" when not reached, and a separator
+void FormatRecoveryStage(char* line, size_t size, bool reached, unsigned long time, char separator) {
+    size_t used = strlen(line);
+    if (reached) {
+        snprintf(line + used, size - used, "%lu%c", time, separator);
+    } else {
+        snprintf(line + used, size - used, "-%c", separator);
+    }
+}
+
+// Function to format a topic as an event line:
+//   door/plate: "$DOOR,<position>,<motion>,<home>\n" / "$PLATE,..."
+//   wpt:        "$WPT,<on>\n"
+//   faults:     "$FLT,<last fault>,<count>,<detect ms>,<safe ms>,<resume ms>\n", with
+//               "-" for a recovery stage not reached yet
+//   metrics:    "$MET,<loops per second>,<max loop us>,<idle per-mille>,<max wake us>,
+//               <max poll gap ms>,<max accept us>,<clients turned away>\n"
+//   ready:      "$TTR,<landing>,<launch>,<closed>,<phase>,<wpt>\n", times in milliseconds.
+//               Landing and launch share the open geometry (door open, plate extended)
+//               on this station; both are published so planners can key on intent.
+// Topics are only sent to clients that subscribed with "$SUB", so a client that
+// only knows the single-letter acknowledgements never receives one.
+void FormatTopic(uint8_t topic, char* line, size_t size) {
+    switch (topic) {
+        case TOPIC_DOOR:
+            snprintf(line, size, "$DOOR,%d,%u,%u\n", doorAxis.position, doorAxis.motion,
+                     IsDoorHome() ? 1u : 0u);
+            break;
+        case TOPIC_PLATE:
+            snprintf(line, size, "$PLATE,%d,%u,%u\n", plateAxis.position, plateAxis.motion,
+                     IsPlateHome() ? 1u : 0u);
+            break;
+        case TOPIC_WPT:
+            snprintf(line, size, "$WPT,%u\n", wirelessPowerState == 0 ? 1u : 0u);
+            break;
+        case TOPIC_FAULTS:
+            snprintf(line, size, "$FLT,%u,%u,%lu,", lastFault, faultCount, recovery.detectTime);
+            FormatRecoveryStage(line, size, recovery.safe, recovery.safeTime, ',');
+            FormatRecoveryStage(line, size, recovery.resumed, recovery.resumeTime, '\n');
+            break;
+        case TOPIC_METRICS:
+            snprintf(line, size, "$MET,%u,%lu,%u,%lu,%lu,%lu,%u\n", loopsPerSecond, maxLoopMicros,
+                     idlePermille, maxWakeMicros, maxPollGap, maxAcceptMicros, busyCount);
+            break;
+        default: {
+            // Door opens before the plate extends; the plate retracts before the door closes
+            unsigned long openTime = RemainingTravelTime(doorAxis, POSITION_OUT)
+                                   + RemainingTravelTime(plateAxis, POSITION_OUT);
+            unsigned long closedTime = RemainingTravelTime(plateAxis, POSITION_HOME)
+                                     + RemainingTravelTime(doorAxis, POSITION_HOME);
+            snprintf(line, size, "$TTR,%lu,%lu,%lu,%u,%u\n",
+                     openTime, openTime, closedTime,
+                     (unsigned)sequencePhase, wirelessPowerState == 0 ? 1u : 0u);
+            break;
+        }
+    }
+}
+
+// Function to send each topic to the clients whose subscription is due. The
+// filtering happens before anything is formatted, so topics nobody asked for
+// cost neither SPI time nor link bandwidth, and a due topic is formatted once
+// for all of its subscribers.
+void PublishTopics() {
+    unsigned long now = millis();
+    for (uint8_t topic = 0; topic < TOPIC_COUNT; topic++) {
+        uint16_t key = TopicChangeKey(topic);
+        char line[72];
+        bool formatted = false;
+
+        for (uint8_t i = 0; i < MAX_SUBSCRIBERS; i++) {
+            Subscriber& subscriber = subscribers[i];
+            // Release slots of clients that went away so the station can idle
+            if (topic == 0 && subscriber.active && !subscriber.client.connected()) {
+                ReleaseSubscriber(subscriber);
+            }
+            Subscription& subscription = subscriber.topics[topic];
+            if (!subscriber.active || subscription.mode == TOPIC_OFF
+                    || now - subscription.lastSentAt < subscription.interval
+                    || (subscription.mode == TOPIC_ON_CHANGE && subscription.lastKey == key)) {
+                continue;
+            }
+            if (!formatted) {
+                FormatTopic(topic, line, sizeof(line));
+                formatted = true;
+            }
+            SendLine(subscriber, line);
+            subscription.lastSentAt = now;
+            subscription.lastKey = key;
+        }
+    }
 }
 
 // Function to enable wireless power
 void EnableWirelessPower() {
-    digitalWrite(WPT_RELAY_PIN, HIGH);  // Assuming HIGH activates the relay
+    digitalWrite(WPT_RELAY_PIN, params[PARAM_WPT_ACTIVE_LEVEL]);   // Activate the relay
 }
 
 // Function to disable wireless power
 void DisableWirelessPower() {
-    digitalWrite(WPT_RELAY_PIN, LOW);   // Assuming LOW deactivates the relay
+    digitalWrite(WPT_RELAY_PIN, !params[PARAM_WPT_ACTIVE_LEVEL]);  // Deactivate the relay
 }
\ No newline at end of file
@@ -1,8 +1,19 @@
 #include <Phpoc.h>
+#include <avr/pgmspace.h>
+#include "StationInterlock.h"
+#include "StationIdleSleep.h"
 
 // WebSocket server instance listening on port 80 for client connections
 PhpocServer server(80);
 
+// Capability descriptor queued to each new session, and sent again on "CAP":
+// "CAP,<variant>,<firmware>,<bays>,<wpt>,<frame protocol>"
+constexpr char STATION_VARIANT[] = "web";      // This sketch: WebSocket port 80 only
+constexpr char FIRMWARE_VERSION[] = "1.0.0";   // Bumped with every released change
+constexpr uint8_t STATION_BAYS = 1;            // Landing bays (door and plate pairs)
+constexpr uint8_t STATION_HAS_WPT = 0;         // No wireless power relay on this variant
+constexpr uint8_t FRAME_PROTOCOL_VERSION = 1;  // Commands, batches, snapshots and keepalives
+
 // Pin assignments using modern C++ constexpr for type safety and clarity
 constexpr int DOOR_DIRECTION_PIN = 4;    // Pin controlling the door motor direction
 constexpr int DOOR_ENABLE_PIN = 5;       // Pin to enable/disable the door motor
@@ -11,12 +22,83 @@ constexpr int PLATE_ENABLE_PIN = 7;      // Pin to enable/disable the landing pl
 constexpr int DOOR_PHOTO_PIN = 8;        // Pin for door photo sensor (LOW when door is closed)
 constexpr int PLATE_PHOTO_PIN = 9;       // Pin for landing plate photo sensor (LOW when plate is retracted)
 
+// Limits for multi-command WebSocket messages (batches)
+constexpr uint8_t MAX_BATCH_STEPS = 16;         // Steps accepted in one message
+constexpr uint8_t MAX_STEP_SIZE = 8;            // Longest step ("?D65535") plus a separator
+constexpr uint8_t MAX_MESSAGE_SIZE = MAX_BATCH_STEPS * MAX_STEP_SIZE; // Longest message accepted
+constexpr unsigned int DEFAULT_WAIT_TIMEOUT = 30000;  // Wait step timeout in milliseconds
+
+// One step of a batch: either a command character or a wait for a sensor state
+struct BatchStep {
+    char command;           // Command character, or '?' for a wait step
+    char condition;         // Wait condition: 'D'/'d' door closed/not closed, 'P'/'p' plate in/not in
+    unsigned int timeout;   // Wait timeout in milliseconds
+};
+
+// Batch currently being executed, one step at a time across loop passes
+BatchStep batchSteps[MAX_BATCH_STEPS];
+uint8_t batchLength = 0;            // Number of parsed steps
+uint8_t batchNext = 0;              // Index of the next step to run
+unsigned long waitStartedAt = 0;    // millis() when the current wait step started
+bool waitStarted = false;           // The current wait step has started timing
+bool batchRunning = false;          // A batch is in progress
+
+// WebSocket session tracking
+constexpr uint8_t MAX_SESSIONS = 4;                 // Sessions tracked (PHPoC serves a few sockets)
+constexpr uint8_t SEND_QUEUE_SIZE = 64;             // Bytes of queued frames per session
+constexpr unsigned long PING_INTERVAL = 10000;      // Quiet time in milliseconds before a PING
+constexpr unsigned long SESSION_TIMEOUT = 30000;    // Quiet time in milliseconds before reaping
+
+// A browser turned away for lack of a session slot is told when to retry with
+// "BUSY,<ms>". The delay is jittered and its range grows while browsers keep
+// being turned away, so a reconnect storm spreads itself out.
+constexpr unsigned long BUSY_RETRY_MIN = 500;       // Shortest retry delay in milliseconds
+constexpr uint8_t BUSY_RETRY_MAX_SCALE = 16;        // Cap on the jitter range, in BUSY_RETRY_MIN
+constexpr unsigned long BUSY_STREAK_WINDOW = 1000;  // Rejections closer than this form a streak
+
+// A connected browser with its keepalive timers and outgoing frames.
+// Frames are queued as <length><bytes> and sent one per loop pass; the state
+// snapshot is not queued but flagged, so it is built from the latest state
+// when it is sent and never queued twice.
+struct Session {
+    bool active;                            // Slot is in use
+    PhpocClient client;                     // Client socket
+    unsigned long lastActivityAt;           // millis() of the last message from the client
+    unsigned long lastPingAt;               // millis() of the last PING sent
+    bool snapshotPending;                   // A state snapshot should be sent
+    uint8_t queue[SEND_QUEUE_SIZE];         // Ring buffer of length-prefixed frames
+    uint8_t queueHead;                      // Index of the first queued byte
+    uint8_t queueCount;                     // Number of queued bytes
+};
+
+Session sessions[MAX_SESSIONS];
+Session* batchSession = nullptr;    // Session that sent the batch and receives its result
+uint8_t busyStreak = 0;             // Browsers turned away in the current streak
+unsigned long lastBusyAt = 0;       // millis() when a browser was last turned away
+uint8_t lastStateBits = 0xFF;       // Sensor and motor state of the last snapshot
+
+// Slowest sensor-edge wake-up from idle sleep since the last report
+unsigned long maxWakeMicros = 0;
+
 // Function prototypes for motor control operations
+// Actuator functions return REASON_OK when started, or the interlock reason otherwise
 void StopAllMotors();       // Stops all motors by disabling them
-void CloseDoor();           // Starts closing the door
-void OpenDoor();            // Starts opening the door
-void RetractPlate();        // Starts retracting the landing plate (moves in)
-void ExtendPlate();         // Starts extending the landing plate (moves out)
+uint8_t CloseDoor();        // Starts closing the door
+uint8_t OpenDoor();         // Starts opening the door
+uint8_t RetractPlate();     // Starts retracting the landing plate (moves in)
+uint8_t ExtendPlate();      // Starts extending the landing plate (moves out)
+uint8_t ExecuteCommand(char command);    // Runs one single-character command
+void HandleMessage(Session* session, const char* message, uint8_t length, bool overLong); // Starts a batch
+uint8_t ReadMessage(PhpocClient& client, char* message, bool& overLong); // Reads one message
+uint8_t StripToken(char* message, uint8_t length, const char* token, bool& found); // Removes a token
+bool ParseBatch(const char* message, uint8_t length, int& errorAt); // Parses a message into steps
+void RunBatch();                         // Runs batch steps until one has to wait
+void FinishBatch(const char* status);    // Sends the result frame and ends the batch
+Session* FindSession(PhpocClient& client);               // Finds or opens a session
+bool QueueFrame(Session* session, const char* frame, uint8_t length); // Queues a frame
+void QueueCapabilities(Session* session); // Queues the capability descriptor
+void ServiceSessions();                  // Reaps, pings and drains the sessions
+bool IsIdle();                           // True when nothing needs the loop to spin
 
 void setup() {
     // Initialize serial communication at 9600 baud for debugging
@@ -26,6 +108,9 @@ void setup() {
 
     // Initialize PHPoC [WiFi] Shield with logging enabled for SPI and network
     Phpoc.begin(PF_LOG_SPI | PF_LOG_NET);
+    // The shield's start-up time varies, which decorrelates the BUSY retry
+    // jitter of stations that were powered up together
+    randomSeed(micros());
 
     // Start WebSocket server with the specified endpoint "remote_push"
     server.beginWebSocket("remote_push");
@@ -42,6 +127,10 @@ void setup() {
     pinMode(DOOR_PHOTO_PIN, INPUT);        // Door photo sensor input pin
     pinMode(PLATE_PHOTO_PIN, INPUT);       // Plate photo sensor input pin
 
+    // Let photo sensor edges wake the MCU from idle sleep
+    EnableSensorWake(DOOR_PHOTO_PIN);
+    EnableSensorWake(PLATE_PHOTO_PIN);
+
     // Initially stop all motors to prevent unintended movement
     StopAllMotors();
 }
@@ -52,103 +141,464 @@ void loop() {
 
     // Check if a client is connected
     if (client) {
-        // Check if there are bytes available to read from the client
-        if (client.available() > 0) {
-            // Read the incoming command character from the client
-            char command = client.read();
-
-            // Read current states of the photo sensors
-            // Assuming DOOR_PHOTO_PIN is LOW when the door is closed
-            bool isDoorClosed = digitalRead(DOOR_PHOTO_PIN) == LOW;
-            // Assuming PLATE_PHOTO_PIN is LOW when the plate is retracted (in)
-            bool isPlateIn = digitalRead(PLATE_PHOTO_PIN) == LOW;
-
-            // Process the command received from the client using a switch statement
-            switch (command) {
-                case 'A':
-                    // Command to extend the landing plate
-                    Serial.println("Extend Plate");
-                    // Extend plate only if the door is closed (sensor LOW)
-                    // Note: This logic might need verification, as extending the plate
-                    // typically requires the door to be open for physical clearance
-                    if (isDoorClosed) {
-                        ExtendPlate();
-                    }
-                    break;
-
-                case 'D':
-                    // Command to retract the landing plate
-                    Serial.println("Retract Plate");
-                    // Start retracting the plate
-                    RetractPlate();
-                    break;
-
-                case 'B':
-                    // Command to open the door
-                    Serial.println("Open Door");
-                    // Start opening the door
-                    OpenDoor();
-                    break;
-
-                case 'E':
-                    // Command to close the door
-                    Serial.println("Close Door");
-                    // Close door only if the plate is retracted (sensor LOW)
-                    // This ensures clearance for door movement
-                    if (isPlateIn) {
-                        CloseDoor();
-                    }
-                    break;
-
-                case 'G':
-                    // Command for takeoff sequence: open door, then extend plate
-                    Serial.println("Take Off Sequence");
-                    // Start sequence only if the plate is retracted (sensor LOW)
-                    if (isPlateIn) {
-                        // Start opening the door
-                        OpenDoor();
-                        // Check if door is closed (sensor LOW) after starting to open
-                        // Note: Immediate check might be premature; door may not be open yet
-                        // Client might need to send separate commands after door opens
-                        if (isDoorClosed) {
-                            ExtendPlate();
-                        }
-                    }
-                    break;
-
-                case 'H':
-                    // Command for landing sequence: retract plate, then close door
-                    Serial.println("Landing Sequence");
-                    // Start retracting the plate
-                    RetractPlate();
-                    // Check if plate is retracted (sensor LOW) after starting to retract
-                    // Note: Immediate check might be premature; plate may not be in yet
-                    // Client might need to send separate commands after plate retracts
-                    if (isPlateIn) {
-                        // Start closing the door
-                        CloseDoor();
-                        // Check if door is closed (sensor LOW) after starting to close
-                        // If door is closed, stop all motors
-                        if (isDoorClosed) {
-                            StopAllMotors();
-                        }
-                    }
-                    break;
-
-                case 'I':
-                    // Command to stop all motor movements
-                    Serial.println("Stop All");
-                    // Stop all motors
-                    StopAllMotors();
-                    break;
-
-                default:
-                    // Handle unrecognized commands
-                    Serial.println("Unknown command");
-                    break;
+        // Look up the client's session; a new session gets a state snapshot
+        Session* session = FindSession(client);
+        if (session == nullptr) {
+            // No free session slot. A Stop All is still run first: a dropped tab
+            // holds its slot for up to SESSION_TIMEOUT, and the operator who
+            // reconnects must be able to stop the station meanwhile.
+            char message[MAX_MESSAGE_SIZE];
+            bool overLong = false;
+            uint8_t messageLength = ReadMessage(client, message, overLong);
+            if (memchr(message, 'I', messageLength) != nullptr) {
+                if (batchRunning) {
+                    FinishBatch("ABORTED");
+                }
+                ExecuteCommand('I');
+            }
+
+            // Then tell the browser when to retry and close the socket
+            if (millis() - lastBusyAt >= BUSY_STREAK_WINDOW) {
+                busyStreak = 0;
+            }
+            if (busyStreak < BUSY_RETRY_MAX_SCALE) {
+                busyStreak++;
+            }
+            lastBusyAt = millis();
+            char frame[16];
+            int length = snprintf(frame, sizeof(frame), "BUSY,%lu",
+                                  BUSY_RETRY_MIN + random(BUSY_RETRY_MIN * busyStreak));
+            client.write((const uint8_t*)frame, length);
+            client.stop();
+        } else if (client.available() > 0) {
+            // A message holds one command character or an ordered batch of commands and waits
+            char message[MAX_MESSAGE_SIZE];
+            bool overLong = false;
+            uint8_t length = ReadMessage(client, message, overLong);
+            session->lastActivityAt = millis();
+
+            // A capability request may share a read with a command; it cannot be
+            // part of a batch, so it is taken out first
+            bool capRequested = false;
+            length = StripToken(message, length, "CAP", capRequested);
+            if (capRequested) {
+                QueueCapabilities(session);
+            }
+            if (length > 0 || overLong) {
+                HandleMessage(session, message, length, overLong);
             }
         }
     }
+
+    // Advance the running batch, if any
+    if (batchRunning) {
+        RunBatch();
+    }
+
+    // Keep sessions alive and send what they are owed
+    ServiceSessions();
+
+    // Nothing to do until the next poll (no session, no batch and both motors
+    // disabled): sleep instead of spinning; the wake-up time is printed when
+    // the next session opens
+    if (IsIdle()) {
+        unsigned long wakeMicros;
+        IdleSleep(wakeMicros);
+        if (wakeMicros > maxWakeMicros) {
+            maxWakeMicros = wakeMicros;
+        }
+    }
+}
+
+// Function to decide whether the loop may sleep: no session, no batch and
+// both motor enable pins inactive (HIGH)
+bool IsIdle() {
+    if (batchRunning || digitalRead(DOOR_ENABLE_PIN) == LOW || digitalRead(PLATE_ENABLE_PIN) == LOW) {
+        return false;
+    }
+    for (uint8_t i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].active) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to read the whole message a client has sent in one pass, returning
+// its length. Anything longer than a full batch is discarded rather than split,
+// so its tail never arrives as a message of its own; overLong is set then.
+// Keepalive answers may share a read with a command and are taken out here.
+uint8_t ReadMessage(PhpocClient& client, char* message, bool& overLong) {
+    uint8_t length = 0;
+    while (client.available() > 0 && length < MAX_MESSAGE_SIZE) {
+        message[length++] = client.read();
+    }
+    while (client.available() > 0) {
+        client.read();
+        overLong = true;
+    }
+    bool ponged = false;
+    return StripToken(message, length, "PONG", ponged);
+}
+
+// Function to remove every occurrence of a token from a message, returning the
+// new length. found is set when the token was present.
+uint8_t StripToken(char* message, uint8_t length, const char* token, bool& found) {
+    uint8_t tokenLength = strlen(token);
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < length; ) {
+        if (length - i >= tokenLength && memcmp(message + i, token, tokenLength) == 0) {
+            found = true;
+            i += tokenLength;
+        } else {
+            message[kept++] = message[i++];
+        }
+    }
+    return kept;
+}
+
+// Function to start a batch from a message, replacing any batch still
+// waiting on a sensor. An over-long message is refused as a parse error at
+// MAX_MESSAGE_SIZE.
+void HandleMessage(Session* session, const char* message, uint8_t length, bool overLong) {
+    if (batchRunning) {
+        FinishBatch("ABORTED");
+    }
+
+    int errorAt = MAX_MESSAGE_SIZE;
+    batchSession = session;
+    if (!overLong && ParseBatch(message, length, errorAt)) {
+        batchRunning = true;
+    } else {
+        // Report where parsing stopped; nothing from the message is run
+        char result[24];
+        int size = snprintf(result, sizeof(result), "R,0/0,PARSE@%d", errorAt);
+        QueueFrame(batchSession, result, size);
+    }
+}
+
+// Function to parse a message into batch steps. Steps are command characters
+// ('A', 'B', 'D', 'E', 'G', 'H', 'I') and waits written as '?' followed by a
+// condition and an optional timeout in milliseconds, e.g. "B?d5000A" opens the
+// door, waits up to 5 s for the door sensor to clear, then extends the plate.
+// Spaces, commas and semicolons between steps are ignored.
+bool ParseBatch(const char* message, uint8_t length, int& errorAt) {
+    batchLength = 0;
+    batchNext = 0;
+    uint8_t i = 0;
+    while (i < length) {
+        char c = message[i];
+        if (c == ' ' || c == ',' || c == ';' || c == '\r' || c == '\n') {
+            i++;
+            continue;
+        }
+        if (batchLength == MAX_BATCH_STEPS) {
+            errorAt = i;
+            return false;
+        }
+        BatchStep& step = batchSteps[batchLength];
+        step.command = c;
+        step.condition = 0;
+        step.timeout = 0;
+        i++;
+
+        if (c == '?') {
+            // Wait step: condition character, then optional decimal timeout
+            if (i == length || strchr("DdPp", message[i]) == nullptr) {
+                errorAt = i;
+                return false;
+            }
+            step.condition = message[i++];
+            unsigned long timeout = 0;
+            bool hasTimeout = false;
+            while (i < length && message[i] >= '0' && message[i] <= '9') {
+                timeout = timeout * 10 + (message[i++] - '0');
+                hasTimeout = true;
+                if (timeout > 65535) {
+                    errorAt = i;
+                    return false;
+                }
+            }
+            step.timeout = hasTimeout ? (unsigned int)timeout : DEFAULT_WAIT_TIMEOUT;
+        } else if (strchr("ABDEGHI", c) == nullptr) {
+            errorAt = i - 1;
+            return false;
+        }
+        batchLength++;
+    }
+    return batchLength > 0;
+}
+
+// Function to check a wait condition against the photo sensors
+bool ConditionMet(char condition) {
+    // Assuming DOOR_PHOTO_PIN is LOW when the door is closed
+    bool isDoorClosed = digitalRead(DOOR_PHOTO_PIN) == LOW;
+    // Assuming PLATE_PHOTO_PIN is LOW when the plate is retracted (in)
+    bool isPlateIn = digitalRead(PLATE_PHOTO_PIN) == LOW;
+
+    switch (condition) {
+        case 'D': return isDoorClosed;
+        case 'd': return !isDoorClosed;
+        case 'P': return isPlateIn;
+        default:  return !isPlateIn;
+    }
+}
+
+// Function to run batch steps in order until a wait step is not yet satisfied.
+// Commands run back to back in the same pass; waits resume on later passes.
+void RunBatch() {
+    while (batchNext < batchLength) {
+        BatchStep& step = batchSteps[batchNext];
+        if (step.command == '?') {
+            if (!waitStarted) {
+                waitStartedAt = millis();
+                waitStarted = true;
+            }
+            if (!ConditionMet(step.condition)) {
+                if (millis() - waitStartedAt >= step.timeout) {
+                    FinishBatch("TIMEOUT");
+                }
+                return;
+            }
+            waitStarted = false;
+        } else {
+            uint8_t reason = ExecuteCommand(step.command);
+            if (reason != REASON_OK) {
+                // A refused command ends the batch; later steps depend on it
+                char status[12];
+                snprintf(status, sizeof(status), "DENIED%u", reason);
+                FinishBatch(status);
+                return;
+            }
+        }
+        batchNext++;
+    }
+    FinishBatch("OK");
+}
+
+// Function to end the batch and answer with one result frame:
+// "R,<steps completed>/<steps>,<status>", status being OK, TIMEOUT, ABORTED
+// or DENIED<reason> when the interlock refused a command
+void FinishBatch(const char* status) {
+    char result[24];
+    int size = snprintf(result, sizeof(result), "R,%u/%u,%s", batchNext, batchLength, status);
+    QueueFrame(batchSession, result, size);
+    batchRunning = false;
+    waitStarted = false;
+}
+
+// Function to find the session of a client, opening one for a new client.
+// Returns nullptr when every slot is taken by a live session.
+Session* FindSession(PhpocClient& client) {
+    Session* freeSlot = nullptr;
+    for (uint8_t i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].active && sessions[i].client == client) {
+            return &sessions[i];
+        }
+        if (!sessions[i].active && freeSlot == nullptr) {
+            freeSlot = &sessions[i];
+        }
+    }
+    if (freeSlot != nullptr) {
+        *freeSlot = Session();
+        freeSlot->active = true;
+        freeSlot->client = client;
+        freeSlot->lastActivityAt = millis();
+        freeSlot->lastPingAt = millis();
+        freeSlot->snapshotPending = true;  // Sync the UI in one frame
+        QueueCapabilities(freeSlot);       // Follows the snapshot
+        Serial.println("Session opened");
+        // Report the idle wake-up latency seen since the last session
+        Serial.print("Max sensor wake-up (us): ");
+        Serial.println(maxWakeMicros);
+        maxWakeMicros = 0;
+    }
+    return freeSlot;
+}
+
+// Function to queue the capability descriptor for a session, so the browser can
+// tell the station variant and protocol without reading the serial console
+void QueueCapabilities(Session* session) {
+    char frame[32];
+    int length = snprintf(frame, sizeof(frame), "CAP,%s,%s,%u,%u,%u",
+                          STATION_VARIANT, FIRMWARE_VERSION, STATION_BAYS, STATION_HAS_WPT,
+                          FRAME_PROTOCOL_VERSION);
+    QueueFrame(session, frame, length);
+}
+
+// Function to queue a frame for a session. Returns false (and drops the frame)
+// when the session's queue is full or the session is gone.
+bool QueueFrame(Session* session, const char* frame, uint8_t length) {
+    if (session == nullptr || !session->active
+            || session->queueCount + length + 1 > SEND_QUEUE_SIZE) {
+        return false;
+    }
+    uint8_t tail = (session->queueHead + session->queueCount) % SEND_QUEUE_SIZE;
+    session->queue[tail] = length;
+    for (uint8_t i = 0; i < length; i++) {
+        session->queue[(tail + 1 + i) % SEND_QUEUE_SIZE] = frame[i];
+    }
+    session->queueCount += length + 1;
+    return true;
+}
+
+// Function to pack the sensor and motor state into bits for change detection:
+// bit 0 door closed, bit 1 plate in, bit 2 door motor on, bit 3 plate motor on
+uint8_t ReadStateBits() {
+    // Motor enable pins are active-low
+    return (digitalRead(DOOR_PHOTO_PIN) == LOW)
+         | (digitalRead(PLATE_PHOTO_PIN) == LOW) << 1
+         | (digitalRead(DOOR_ENABLE_PIN) == LOW) << 2
+         | (digitalRead(PLATE_ENABLE_PIN) == LOW) << 3;
+}
+
+// Function to close a session and release its slot
+void CloseSession(Session& session) {
+    session.client.stop();
+    session.active = false;
+    if (batchSession == &session) {
+        batchSession = nullptr;  // A running batch finishes without a reply
+    }
+    Serial.println("Session closed");
+}
+
+// Function to service every session once per loop pass: reap dropped or
+// silent sessions, send a PING after a quiet spell, and send at most one
+// frame. Any message from the browser counts as activity; a UI answers
+// "PING" with "PONG" when it has nothing else to send. A snapshot
+// "S,<door closed>,<plate in>,<door motor on>,<plate motor on>" is sent on
+// connect and whenever the state changes.
+void ServiceSessions() {
+    unsigned long now = millis();
+    uint8_t stateBits = ReadStateBits();
+    bool stateChanged = stateBits != lastStateBits;
+    lastStateBits = stateBits;
+
+    for (uint8_t i = 0; i < MAX_SESSIONS; i++) {
+        Session& session = sessions[i];
+        if (!session.active) {
+            continue;
+        }
+        if (!session.client.connected() || now - session.lastActivityAt >= SESSION_TIMEOUT) {
+            CloseSession(session);
+            continue;
+        }
+        if (now - session.lastActivityAt >= PING_INTERVAL && now - session.lastPingAt >= PING_INTERVAL) {
+            if (QueueFrame(&session, "PING", 4)) {
+                session.lastPingAt = now;
+            }
+        }
+        if (stateChanged) {
+            session.snapshotPending = true;
+        }
+
+        // Send one frame: a pending snapshot first so a new session syncs
+        // before anything else, then queued replies
+        if (session.snapshotPending) {
+            char snapshot[16];
+            int length = snprintf(snapshot, sizeof(snapshot), "S,%u,%u,%u,%u",
+                                  stateBits & 1, (stateBits >> 1) & 1,
+                                  (stateBits >> 2) & 1, (stateBits >> 3) & 1);
+            session.client.write((const uint8_t*)snapshot, length);
+            session.snapshotPending = false;
+        } else if (session.queueCount > 0) {
+            uint8_t frame[SEND_QUEUE_SIZE];
+            uint8_t length = session.queue[session.queueHead];
+            for (uint8_t j = 0; j < length; j++) {
+                frame[j] = session.queue[(session.queueHead + 1 + j) % SEND_QUEUE_SIZE];
+            }
+            session.queueHead = (session.queueHead + length + 1) % SEND_QUEUE_SIZE;
+            session.queueCount -= length + 1;
+            session.client.write(frame, length);
+        }
+    }
+}
+
+// Function to pack the sensors and motor pins into an interlock state byte.
+// Enable pins are active-low; direction HIGH closes the door / retracts the plate.
+uint8_t ReadInterlockState() {
+    return (digitalRead(DOOR_PHOTO_PIN) == LOW ? STATE_DOOR_CLOSED : 0)
+         | (digitalRead(PLATE_PHOTO_PIN) == LOW ? STATE_PLATE_IN : 0)
+         | (digitalRead(DOOR_ENABLE_PIN) == LOW ? STATE_DOOR_RUNNING : 0)
+         | (digitalRead(DOOR_DIRECTION_PIN) == HIGH ? STATE_DOOR_CLOSING : 0)
+         | (digitalRead(PLATE_ENABLE_PIN) == LOW ? STATE_PLATE_RUNNING : 0)
+         | (digitalRead(PLATE_DIRECTION_PIN) == HIGH ? STATE_PLATE_RETRACTING : 0);
+}
+
+// Function to run one command character received from the client.
+// Returns REASON_OK, or the interlock reason when a single-actuator command
+// is refused. The takeoff and landing shortcuts run whatever steps the
+// interlock allows right now and report nothing.
+uint8_t ExecuteCommand(char command) {
+    uint8_t reason = REASON_OK;
+
+    // Process the command received from the client using a switch statement
+    switch (command) {
+        case 'A':
+            // Command to extend the landing plate
+            Serial.println("Extend Plate");
+            // The interlock requires the door sensor to report not closed
+            reason = ExtendPlate();
+            break;
+
+        case 'D':
+            // Command to retract the landing plate
+            Serial.println("Retract Plate");
+            // Start retracting the plate
+            reason = RetractPlate();
+            break;
+
+        case 'B':
+            // Command to open the door
+            Serial.println("Open Door");
+            // Start opening the door
+            reason = OpenDoor();
+            break;
+
+        case 'E':
+            // Command to close the door
+            Serial.println("Close Door");
+            // The interlock requires the plate to be retracted (sensor LOW)
+            // This ensures clearance for door movement
+            reason = CloseDoor();
+            break;
+
+        case 'G':
+            // Command for takeoff sequence: open door, then extend plate
+            Serial.println("Take Off Sequence");
+            // Start opening the door
+            OpenDoor();
+            // The plate only extends if the door sensor already reports open;
+            // otherwise send a batch such as "B?dA" to wait for the door
+            ExtendPlate();
+            break;
+
+        case 'H':
+            // Command for landing sequence: retract plate, then close door
+            Serial.println("Landing Sequence");
+            // Start retracting the plate
+            RetractPlate();
+            // The door only closes if the plate sensor already reports in;
+            // otherwise send a batch such as "D?PE" to wait for the plate
+            if (CloseDoor() == REASON_OK && digitalRead(DOOR_PHOTO_PIN) == LOW) {
+                // Door is already closed: nothing left to move
+                StopAllMotors();
+            }
+            break;
+
+        case 'I':
+            // Command to stop all motor movements
+            Serial.println("Stop All");
+            // Stop all motors
+            StopAllMotors();
+            break;
+
+        default:
+            // Handle unrecognized commands
+            Serial.println("Unknown command");
+            break;
+    }
+    return reason;
 }
 
 // Function to stop all motors by disabling them
@@ -161,31 +611,51 @@ void StopAllMotors() {
 // Function to start closing the door
 // Note: Direction pin HIGH sets motor to close direction
 //       Enable pin LOW activates the motor
-void CloseDoor() {
+uint8_t CloseDoor() {
+    uint8_t reason = InterlockLookup(ReadInterlockState(), INTERLOCK_CLOSE_DOOR);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(DOOR_DIRECTION_PIN, HIGH);  // Set direction to close
     digitalWrite(DOOR_ENABLE_PIN, LOW);      // Enable motor
+    return REASON_OK;
 }
 
 // Function to start opening the door
 // Note: Direction pin LOW sets motor to open direction
 //       Enable pin LOW activates the motor
-void OpenDoor() {
+uint8_t OpenDoor() {
+    uint8_t reason = InterlockLookup(ReadInterlockState(), INTERLOCK_OPEN_DOOR);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(DOOR_DIRECTION_PIN, LOW);   // Set direction to open
     digitalWrite(DOOR_ENABLE_PIN, LOW);      // Enable motor
+    return REASON_OK;
 }
 
 // Function to start retracting the landing plate (move in)
 // Note: Direction pin HIGH sets motor to retract direction
 //       Enable pin LOW activates the motor
-void RetractPlate() {
+uint8_t RetractPlate() {
+    uint8_t reason = InterlockLookup(ReadInterlockState(), INTERLOCK_RETRACT_PLATE);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(PLATE_DIRECTION_PIN, HIGH); // Set direction to retract (in)
     digitalWrite(PLATE_ENABLE_PIN, LOW);     // Enable motor
+    return REASON_OK;
 }
 
 // Function to start extending the landing plate (move out)
 // Note: Direction pin LOW sets motor to extend direction
 //       Enable pin LOW activates the motor
-void ExtendPlate() {
+uint8_t ExtendPlate() {
+    uint8_t reason = InterlockLookup(ReadInterlockState(), INTERLOCK_EXTEND_PLATE);
+    if (reason != REASON_OK) {
+        return reason;
+    }
     digitalWrite(PLATE_DIRECTION_PIN, LOW);  // Set direction to extend (out)
     digitalWrite(PLATE_ENABLE_PIN, LOW);     // Enable motor
+    return REASON_OK;
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+// Idle low-power mode shared by the station sketches.
+// When a sketch has nothing to do, the MCU sleeps between shield polls. Timer 0
+// keeps running in idle sleep, so millis() stays correct and wakes the CPU every
+// millisecond; a photo sensor edge wakes it through the pin-change interrupt.
+// The PHPoC shield has no interrupt line and the stations have no e-stop input,
+// so the shield is polled at IDLE_POLL_INTERVAL, which bounds the extra latency
+// of a command or a new client's first message while idle.
+#ifndef STATION_IDLE_SLEEP_H
+#define STATION_IDLE_SLEEP_H
+
+#include <avr/sleep.h>
+#include <avr/power.h>
+
+constexpr unsigned long IDLE_POLL_INTERVAL = 20;  // Longest sleep in milliseconds between polls
+volatile bool sensorWake = false;                 // Set by a photo sensor edge
+volatile unsigned long sensorWakeAt = 0;          // micros() of that edge
+
+// Function to enable the pin-change interrupt of a sensor pin, where the board
+// has one (pins 8 and 9 do on the Uno, not on the Mega, which then only polls)
+void EnableSensorWake(int pin) {
+    volatile uint8_t* pcicr = digitalPinToPCICR(pin);
+    if (pcicr != nullptr) {
+        *digitalPinToPCMSK(pin) |= bit(digitalPinToPCMSKbit(pin));
+        *pcicr |= bit(digitalPinToPCICRbit(pin));
+    }
+}
+
+#if defined(PCINT0_vect)
+// Pin-change interrupt for the photo sensors: only records the edge, the loop does the work
+ISR(PCINT0_vect) {
+    sensorWake = true;
+    sensorWakeAt = micros();
+}
+#endif
+
+// Function to sleep in idle mode until IDLE_POLL_INTERVAL has passed or a
+// sensor edge arrives. ADC and TWI are unused and stay powered down while
+// asleep. Returns the time slept in milliseconds; wakeMicros is set to the time
+// from a sensor edge to the loop resuming, or 0 when no edge woke it.
+unsigned long IdleSleep(unsigned long& wakeMicros) {
+    unsigned long sleepStartedAt = millis();
+    power_adc_disable();
+    power_twi_disable();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (!sensorWake && millis() - sleepStartedAt < IDLE_POLL_INTERVAL) {
+        sleep_enable();
+        sleep_cpu();
+        sleep_disable();
+    }
+    power_twi_enable();
+    power_adc_enable();
+
+    wakeMicros = 0;
+    if (sensorWake) {
+        noInterrupts();
+        wakeMicros = micros() - sensorWakeAt;
+        sensorWake = false;
+        interrupts();
+    }
+    return millis() - sleepStartedAt;
+}
+
+#endif  // STATION_IDLE_SLEEP_H
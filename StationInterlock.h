@@ -0,0 +1,97 @@
+// Station interlock table shared by the station sketches.
+// Every actuator command is checked against the current sensor and actuator
+// state with one flash lookup; the table is built and verified at compile time.
+#ifndef STATION_INTERLOCK_H
+#define STATION_INTERLOCK_H
+
+#include <avr/pgmspace.h>
+
+// Interlock state byte: sensors and actuators packed into one index so every
+// actuator command can be checked with a single table lookup
+constexpr uint8_t STATE_DOOR_CLOSED = 1 << 0;     // Door photo sensor reports closed
+constexpr uint8_t STATE_PLATE_IN = 1 << 1;        // Plate photo sensor reports retracted
+constexpr uint8_t STATE_DOOR_RUNNING = 1 << 2;    // Door motor is moving
+constexpr uint8_t STATE_DOOR_CLOSING = 1 << 3;    // Door motor direction is close
+constexpr uint8_t STATE_PLATE_RUNNING = 1 << 4;   // Plate motor is moving
+constexpr uint8_t STATE_PLATE_RETRACTING = 1 << 5;// Plate motor direction is retract
+constexpr uint8_t STATE_WPT_ON = 1 << 6;          // Wireless power relay is on
+constexpr uint8_t INTERLOCK_STATES = 1 << 7;      // Number of packed states
+
+// Actuator commands checked against the interlock table (Stop All never is)
+enum InterlockCommand : uint8_t {
+    INTERLOCK_OPEN_DOOR = 0,
+    INTERLOCK_CLOSE_DOOR,
+    INTERLOCK_EXTEND_PLATE,
+    INTERLOCK_RETRACT_PLATE,
+    INTERLOCK_WPT_ON,
+    INTERLOCK_WPT_OFF,
+    INTERLOCK_COMMAND_COUNT
+};
+
+// Result of an interlock lookup; zero means allowed, anything else is the reason for denial
+enum InterlockReason : uint8_t {
+    REASON_OK = 0,
+    REASON_DOOR_CLOSED,         // Plate cannot extend through a closed door
+    REASON_DOOR_CLOSING,        // Plate cannot extend while the door is closing
+    REASON_PLATE_OUT,           // Door cannot close on a plate that is not retracted
+    REASON_PLATE_EXTENDING,     // Door cannot close while the plate is extending
+    REASON_PLATE_MOVING,        // Wireless power cannot start while the plate moves
+    REASON_WPT_ON,              // Plate cannot move while wireless power is on
+    REASON_STOP_ALL             // Motion refused because a Stop All arrived with it (not in the table)
+};
+
+// Interlock rules for one packed state and command, evaluated at compile time
+constexpr uint8_t InterlockRule(uint8_t state, uint8_t command) {
+    return command == INTERLOCK_EXTEND_PLATE
+               ? ((state & STATE_WPT_ON) ? REASON_WPT_ON
+                  : (state & STATE_DOOR_CLOSED) ? REASON_DOOR_CLOSED
+                  : ((state & STATE_DOOR_RUNNING) && (state & STATE_DOOR_CLOSING)) ? REASON_DOOR_CLOSING
+                  : REASON_OK)
+         : command == INTERLOCK_CLOSE_DOOR
+               ? (!(state & STATE_PLATE_IN) ? REASON_PLATE_OUT
+                  : ((state & STATE_PLATE_RUNNING) && !(state & STATE_PLATE_RETRACTING)) ? REASON_PLATE_EXTENDING
+                  : REASON_OK)
+         : command == INTERLOCK_RETRACT_PLATE
+               ? ((state & STATE_WPT_ON) ? REASON_WPT_ON : REASON_OK)
+         : command == INTERLOCK_WPT_ON
+               ? ((state & STATE_PLATE_RUNNING) ? REASON_PLATE_MOVING : REASON_OK)
+         : REASON_OK;
+}
+
+#define INTERLOCK_ROW(s) { InterlockRule(s, 0), InterlockRule(s, 1), InterlockRule(s, 2), \
+                           InterlockRule(s, 3), InterlockRule(s, 4), InterlockRule(s, 5) }
+#define INTERLOCK_ROWS_8(s) INTERLOCK_ROW(s), INTERLOCK_ROW(s + 1), INTERLOCK_ROW(s + 2), INTERLOCK_ROW(s + 3), \
+                            INTERLOCK_ROW(s + 4), INTERLOCK_ROW(s + 5), INTERLOCK_ROW(s + 6), INTERLOCK_ROW(s + 7)
+#define INTERLOCK_ROWS_64(s) INTERLOCK_ROWS_8(s), INTERLOCK_ROWS_8(s + 8), INTERLOCK_ROWS_8(s + 16), \
+                             INTERLOCK_ROWS_8(s + 24), INTERLOCK_ROWS_8(s + 32), INTERLOCK_ROWS_8(s + 40), \
+                             INTERLOCK_ROWS_8(s + 48), INTERLOCK_ROWS_8(s + 56)
+
+// Precomputed interlock table in flash, indexed by [packed state][command].
+// Reading it is a single pgm_read_byte, so it is safe from interrupt context.
+constexpr uint8_t INTERLOCK_TABLE[INTERLOCK_STATES][INTERLOCK_COMMAND_COUNT] PROGMEM = {
+    INTERLOCK_ROWS_64(0), INTERLOCK_ROWS_64(64)
+};
+
+// Exhaustive compile-time check of the table over all packed states: the
+// plate never extends into a closed door, the door never closes on a plate
+// that is out, the plate and wireless power never run together, opening and
+// power-off are never refused, and retracting is refused only while charging
+constexpr bool InterlockTableIsSafe(uint8_t state) {
+    return state == INTERLOCK_STATES
+        || ((!(state & STATE_DOOR_CLOSED) || INTERLOCK_TABLE[state][INTERLOCK_EXTEND_PLATE] != REASON_OK)
+            && ((state & STATE_PLATE_IN) || INTERLOCK_TABLE[state][INTERLOCK_CLOSE_DOOR] != REASON_OK)
+            && INTERLOCK_TABLE[state][INTERLOCK_OPEN_DOOR] == REASON_OK
+            && (!(state & STATE_PLATE_RUNNING) || INTERLOCK_TABLE[state][INTERLOCK_WPT_ON] != REASON_OK)
+            && (!(state & STATE_WPT_ON) || INTERLOCK_TABLE[state][INTERLOCK_EXTEND_PLATE] != REASON_OK)
+            && ((state & STATE_WPT_ON) || INTERLOCK_TABLE[state][INTERLOCK_RETRACT_PLATE] == REASON_OK)
+            && INTERLOCK_TABLE[state][INTERLOCK_WPT_OFF] == REASON_OK
+            && InterlockTableIsSafe(state + 1));
+}
+static_assert(InterlockTableIsSafe(0), "Interlock table violates a safety rule");
+
+// Function to look up an actuator command for a packed state; usable from an ISR
+inline uint8_t InterlockLookup(uint8_t state, uint8_t command) {
+    return pgm_read_byte(&INTERLOCK_TABLE[state & (INTERLOCK_STATES - 1)][command]);
+}
+
+#endif  // STATION_INTERLOCK_H